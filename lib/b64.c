@@ -0,0 +1,204 @@
+/*
+ *  megatools - Mega.nz client library and tools
+ *  Copyright (C) 2013  Ondřej Jirman <megous@megous.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+
+#include "b64.h"
+
+// SSSE3 fast path: compiled with a function level target attribute so no
+// special build flags are needed, used only when the CPU supports it
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#define B64_SSSE3 1
+#include <tmmintrin.h>
+#endif
+
+// {{{ lookup tables
+
+static const gchar enc_lut[64] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+static guchar dec_lut[256];
+
+#ifdef B64_SSSE3
+static gboolean have_ssse3;
+#endif
+
+static void b64_init(void)
+{
+  static gsize initialized;
+
+  if (g_once_init_enter(&initialized))
+  {
+    gint i;
+
+    memset(dec_lut, 0xff, sizeof(dec_lut));
+    for (i = 0; i < 64; i++)
+      dec_lut[(guchar)enc_lut[i]] = i;
+
+    // accept the standard alphabet too
+    dec_lut['+'] = 62;
+    dec_lut['/'] = 63;
+
+#ifdef B64_SSSE3
+    have_ssse3 = __builtin_cpu_supports("ssse3");
+#endif
+
+    g_once_init_leave(&initialized, 1);
+  }
+}
+
+// }}}
+// {{{ b64_urlencode
+
+gchar* b64_urlencode(const guchar* data, gsize len)
+{
+  gchar *out, *p;
+  gsize i = 0;
+
+  g_return_val_if_fail(data != NULL, NULL);
+
+  out = p = g_malloc((len + 2) / 3 * 4 + 1);
+
+  while (i + 3 <= len)
+  {
+    guint v = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+
+    *p++ = enc_lut[(v >> 18) & 0x3f];
+    *p++ = enc_lut[(v >> 12) & 0x3f];
+    *p++ = enc_lut[(v >> 6) & 0x3f];
+    *p++ = enc_lut[v & 0x3f];
+    i += 3;
+  }
+
+  if (len - i == 1)
+  {
+    *p++ = enc_lut[data[i] >> 2];
+    *p++ = enc_lut[(data[i] << 4) & 0x3f];
+  }
+  else if (len - i == 2)
+  {
+    *p++ = enc_lut[data[i] >> 2];
+    *p++ = enc_lut[((data[i] << 4) | (data[i + 1] >> 4)) & 0x3f];
+    *p++ = enc_lut[(data[i + 1] << 2) & 0x3f];
+  }
+
+  *p = '\0';
+  return out;
+}
+
+// }}}
+// {{{ b64_urldecode
+
+#ifdef B64_SSSE3
+
+// Decode whole 16-char blocks to 12 output bytes at a time (the pshufb
+// nibble classification scheme by W. Muła). Stops at the first block with
+// a byte outside the alphabet and lets the scalar loop deal with the
+// rest. '-' and '_' are first mapped to their standard alphabet
+// equivalents so the classifier only needs to know one alphabet.
+__attribute__((target("ssse3")))
+static void b64_urldecode_ssse3(const gchar* str, gsize str_len, guchar* out, gsize* pos, gsize* opos)
+{
+  const __m128i lut_lo = _mm_setr_epi8(
+    0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+    0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+  const __m128i lut_hi = _mm_setr_epi8(
+    0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m128i lut_roll = _mm_setr_epi8(
+    0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i mask_0f = _mm_set1_epi8(0x0f);
+  const __m128i mask_2f = _mm_set1_epi8(0x2f);
+
+  // each iteration stores 16 bytes (12 valid), so stay 24 chars short of
+  // the end and the stores always fit into the output buffer
+  while (*pos + 24 <= str_len)
+  {
+    __m128i in = _mm_loadu_si128((const __m128i*)(str + *pos));
+
+    // '_' (0x5f) -> '/' (0x2f), '-' (0x2d) -> '+' (0x2b)
+    in = _mm_sub_epi8(in, _mm_and_si128(_mm_cmpeq_epi8(in, _mm_set1_epi8(0x5f)), _mm_set1_epi8(0x30)));
+    in = _mm_sub_epi8(in, _mm_and_si128(_mm_cmpeq_epi8(in, _mm_set1_epi8(0x2d)), _mm_set1_epi8(0x02)));
+
+    __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(in, 4), mask_0f);
+    __m128i lo_nibbles = _mm_and_si128(in, mask_0f);
+    __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+    __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+
+    if (_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())))
+      return;
+
+    __m128i eq_2f = _mm_cmpeq_epi8(in, mask_2f);
+    __m128i roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2f, hi_nibbles));
+    __m128i values = _mm_add_epi8(in, roll);
+
+    // pack 16x 6-bit values into 12 bytes
+    __m128i merged = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    merged = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+    merged = _mm_shuffle_epi8(merged, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+
+    _mm_storeu_si128((__m128i*)(out + *opos), merged);
+
+    *pos += 16;
+    *opos += 12;
+  }
+}
+
+#endif
+
+guchar* b64_urldecode(const gchar* str, gsize str_len, gsize* out_len)
+{
+  guchar* out;
+  gsize pos = 0, opos = 0;
+  guint acc = 0;
+  gint nbits = 0;
+
+  g_return_val_if_fail(str != NULL, NULL);
+  g_return_val_if_fail(out_len != NULL, NULL);
+
+  b64_init();
+
+  out = g_malloc0((str_len + 3) / 4 * 3 + 3);
+
+#ifdef B64_SSSE3
+  if (have_ssse3)
+    b64_urldecode_ssse3(str, str_len, out, &pos, &opos);
+#endif
+
+  for (; pos < str_len; pos++)
+  {
+    guchar v = dec_lut[(guchar)str[pos]];
+
+    if (v == 0xff)
+      continue;
+
+    acc = (acc << 6) | v;
+    nbits += 6;
+
+    if (nbits >= 8)
+    {
+      nbits -= 8;
+      out[opos++] = acc >> nbits;
+    }
+  }
+
+  *out_len = opos;
+  return out;
+}
+
+// }}}
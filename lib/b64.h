@@ -0,0 +1,33 @@
+/*
+ *  megatools - Mega.nz client library and tools
+ *  Copyright (C) 2013  Ondřej Jirman <megous@megous.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __MEGA_B64_H
+#define __MEGA_B64_H
+
+#include <glib.h>
+
+// base64url codec used for every node key, handle and attribute blob. The
+// decoder has a vectorized fast path selected at runtime; both accept the
+// standard +/ alphabet too and skip invalid input bytes, matching the
+// g_base64 behavior the library used before. Output is unpadded.
+
+gchar*  b64_urlencode(const guchar* data, gsize len);
+guchar* b64_urldecode(const gchar* str, gsize str_len, gsize* out_len);
+
+#endif
@@ -18,6 +18,7 @@
  */
 
 #include "http.h"
+#include "profile.h"
 #include "config.h"
 #include <curl/curl.h>
 #include <string.h>
@@ -42,6 +43,51 @@ struct _http
   time_t last_progress;
 };
 
+// All easy handles created by http_new attach to one process wide share, so
+// consecutive transfers reuse resolved names, TLS sessions and (with curl >=
+// 7.57.0) open connections, instead of paying DNS + TCP slow-start + TLS
+// handshake for every file. The share is never freed, it lives for the
+// lifetime of the process.
+
+static CURLSH* http_share;
+static GMutex http_share_locks[CURL_LOCK_DATA_LAST];
+
+static void share_lock(CURL* handle, curl_lock_data data, curl_lock_access access, void* userptr)
+{
+  g_mutex_lock(&http_share_locks[data]);
+}
+
+static void share_unlock(CURL* handle, curl_lock_data data, void* userptr)
+{
+  g_mutex_unlock(&http_share_locks[data]);
+}
+
+static CURLSH* http_get_share(void)
+{
+  static gsize init = 0;
+
+  if (g_once_init_enter(&init))
+  {
+    CURLSH* sh = curl_share_init();
+
+    if (sh)
+    {
+      curl_share_setopt(sh, CURLSHOPT_LOCKFUNC, share_lock);
+      curl_share_setopt(sh, CURLSHOPT_UNLOCKFUNC, share_unlock);
+      curl_share_setopt(sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+      curl_share_setopt(sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if CURL_AT_LEAST_VERSION(7,57,0)
+      curl_share_setopt(sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+    }
+
+    http_share = sh;
+    g_once_init_leave(&init, 1);
+  }
+
+  return http_share;
+}
+
 http* http_new(void)
 {
   http* h = g_new0(http, 1);
@@ -58,7 +104,13 @@ http* http_new(void)
 #else
   curl_easy_setopt(h->curl, CURLOPT_ENCODING, "");
 #endif
+#if CURL_AT_LEAST_VERSION(7,59,0)
+  // race v4/v6 connects (happy eyeballs) instead of pinning IPv4; a
+  // short grace keeps the fallback fast when one family blackholes
+  curl_easy_setopt(h->curl, CURLOPT_HAPPY_EYEBALLS_TIMEOUT_MS, 150L);
+#else
   curl_easy_setopt(h->curl, CURLOPT_IPRESOLVE, CURL_IPRESOLVE_V4);
+#endif
 
 #if DEBUG_CURL == 1
   curl_easy_setopt(h->curl, CURLOPT_VERBOSE, 1L);
@@ -69,6 +121,13 @@ http* http_new(void)
 
   curl_easy_setopt(h->curl, CURLOPT_FOLLOWLOCATION, 1L);
 
+  // ride warm connections from previous transfers
+  if (http_get_share())
+    curl_easy_setopt(h->curl, CURLOPT_SHARE, http_get_share());
+#if CURL_AT_LEAST_VERSION(7,25,0)
+  curl_easy_setopt(h->curl, CURLOPT_TCP_KEEPALIVE, 1L);
+#endif
+
   h->headers = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
 
   // set default headers
@@ -133,6 +192,97 @@ static int curl_progress(http* h, double dltotal, double dlnow, double ultotal,
   return 0;
 }
 
+// {{{ bandwidth scheduler
+
+// Global token buckets shared by every handle in the process, so N
+// concurrent transfers obey one aggregate cap instead of N times the
+// per-handle limit. Enforcement happens in the transfer callbacks:
+// uploads shrink the amount handed to curl, downloads block until the
+// received bytes fit the budget, which stalls the connection and lets
+// TCP flow control pace the server. A single take is capped to 1/8 of
+// the per-second budget, so concurrent transfers interleave fairly and
+// each gets a minimum share instead of one stream draining the bucket.
+// API traffic is not throttled, only file data.
+
+struct _bw_bucket
+{
+  GMutex lock;
+  gint64 limit; // bytes/s, 0 = unlimited
+  gint64 tokens;
+  gint64 last_fill; // monotonic us
+};
+
+static struct _bw_bucket bw_up, bw_down;
+
+void http_set_speed_global(gint max_ul, gint max_dl)
+{
+  struct _bw_bucket* buckets[] = { &bw_up, &bw_down };
+  gint limits[] = { max_ul, max_dl };
+  gint i;
+
+  for (i = 0; i < 2; i++)
+  {
+    if (limits[i] < 0)
+      continue;
+
+    g_mutex_lock(&buckets[i]->lock);
+    buckets[i]->limit = (gint64)limits[i] * 1024;
+    buckets[i]->tokens = 0;
+    buckets[i]->last_fill = g_get_monotonic_time();
+    g_mutex_unlock(&buckets[i]->lock);
+  }
+}
+
+static gsize bw_bucket_take(struct _bw_bucket* b, gsize want)
+{
+  gsize granted;
+
+  if (want == 0)
+    return 0;
+
+  g_mutex_lock(&b->lock);
+
+  if (b->limit == 0)
+  {
+    g_mutex_unlock(&b->lock);
+    return want;
+  }
+
+  // keep single takes small so concurrent streams interleave
+  want = MIN(want, (gsize)MAX(b->limit / 8, 4096));
+
+  for (;;)
+  {
+    gint64 now = g_get_monotonic_time();
+
+    // refill from elapsed time, allowing a 250ms burst
+    b->tokens = MIN(b->tokens + (now - b->last_fill) * b->limit / G_USEC_PER_SEC, b->limit / 4);
+    b->last_fill = now;
+
+    if (b->tokens > 0)
+      break;
+
+    // wait for the next refill with the lock dropped
+    g_mutex_unlock(&b->lock);
+    g_usleep(10 * 1000);
+    g_mutex_lock(&b->lock);
+
+    if (b->limit == 0)
+    {
+      g_mutex_unlock(&b->lock);
+      return want;
+    }
+  }
+
+  granted = MIN(want, (gsize)b->tokens);
+  b->tokens -= granted;
+
+  g_mutex_unlock(&b->lock);
+  return granted;
+}
+
+// }}}
+
 void http_set_speed(http* h, gint max_ul, gint max_dl)
 {
   if (max_ul >= 0)
@@ -178,6 +328,18 @@ static size_t append_gstring(void *buffer, size_t size, size_t nmemb, GString *s
   return nmemb;
 }
 
+static void profile_handshake(CURL* curl)
+{
+  double connect_time = 0;
+
+  if (!mega_profile_enabled)
+    return;
+
+  // non-zero only when this request had to open a new connection
+  if (curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME, &connect_time) == CURLE_OK && connect_time > 0)
+    mega_profile_add("http.handshake", (gint64)(connect_time * 1e6), 0);
+}
+
 GString* http_post(http* h, const gchar* url, const gchar* body, gssize body_len, GError** err)
 {
   struct curl_slist* headers = NULL;
@@ -215,7 +377,10 @@ GString* http_post(http* h, const gchar* url, const gchar* body, gssize body_len
   curl_easy_setopt(h->curl, CURLOPT_WRITEDATA, response);
 
   // perform HTTP request
+  MEGA_PROFILE_BEGIN(span);
   res = curl_easy_perform(h->curl);
+  profile_handshake(h->curl);
+  MEGA_PROFILE_END(span, "http.post", response->len);
 
   // check the result
   if (res == CURLE_OK)
@@ -269,7 +434,10 @@ struct _stream_data
 
 static size_t curl_read(void *buffer, size_t size, size_t nmemb, struct _stream_data* data)
 {
-  return data->cb(buffer, size * nmemb, data->user_data);
+  // hand curl only as much as the aggregate upload budget allows
+  gsize len = bw_bucket_take(&bw_up, size * nmemb);
+
+  return data->cb(buffer, len, data->user_data);
 }
 
 GString* http_post_stream_upload(http* h, const gchar* url, goffset len, http_data_fn read_cb, gpointer user_data, GError** err)
@@ -308,7 +476,10 @@ GString* http_post_stream_upload(http* h, const gchar* url, goffset len, http_da
   curl_easy_setopt(h->curl, CURLOPT_HTTPHEADER, headers);
 
   // perform HTTP request
+  MEGA_PROFILE_BEGIN(span);
   res = curl_easy_perform(h->curl);
+  profile_handshake(h->curl);
+  MEGA_PROFILE_END(span, "http.upload", len > 0 ? (guint64)len : 0);
 
   // check the result
   if (res == CURLE_OK)
@@ -352,7 +523,14 @@ out:
 
 static size_t curl_write(void *buffer, size_t size, size_t nmemb, struct _stream_data* data)
 {
-  return data->cb(buffer, size * nmemb, data->user_data);
+  gsize total = size * nmemb, budgeted = 0;
+
+  // the data already arrived, so block until it fits the aggregate
+  // download budget; the stalled connection paces the server via TCP
+  while (budgeted < total)
+    budgeted += bw_bucket_take(&bw_down, total - budgeted);
+
+  return data->cb(buffer, total, data->user_data);
 }
 
 static CURLcode curl_easy_perform_retry_empty(CURL* curl)
@@ -419,7 +597,18 @@ gboolean http_get_stream_download(http* h, const gchar* url, http_data_fn write_
   curl_easy_setopt(h->curl, CURLOPT_HTTPHEADER, headers);
 
   // perform HTTP request
+  MEGA_PROFILE_BEGIN(span);
   res = curl_easy_perform_retry_empty(h->curl);
+  profile_handshake(h->curl);
+
+  if (mega_profile_enabled)
+  {
+    double dl_bytes = 0;
+
+    curl_easy_getinfo(h->curl, CURLINFO_SIZE_DOWNLOAD, &dl_bytes);
+    mega_profile_add("http.download", g_get_monotonic_time() - span, (guint64)dl_bytes);
+  }
+
   // check the result
   if (res == CURLE_OK)
   {
@@ -48,6 +48,9 @@ void http_no_expect(http* h);
 void http_set_header(http* h, const gchar* name, const gchar* value);
 void http_set_progress_callback(http* h, http_progress_fn cb, gpointer data);
 void http_set_speed(http* h, gint max_ul, gint max_dl);
+// aggregate up/down caps in KiB/s shared by all handles in the process
+// (0 = unlimited, negative leaves the current setting)
+void http_set_speed_global(gint max_ul, gint max_dl);
 void http_set_proxy(http* h, const gchar* proxy);
 
 GString* http_post(http* h, const gchar* url, const gchar* body, gssize body_len, GError** err);
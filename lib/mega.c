@@ -22,14 +22,21 @@
 #include "http.h"
 #include "sjson.h"
 #include "alloc.h"
+#include "profile.h"
+#include "b64.h"
 
 #include <gio/gio.h>
 #include <glib/gstdio.h>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
+#ifdef HAVE_GIO_UNIX
+#include <gio/gfiledescriptorbased.h>
+#include <fcntl.h>
+#endif
 #include <openssl/aes.h>
 #include <openssl/modes.h>
+#include <openssl/evp.h>
 #include <openssl/bn.h>
 #include <openssl/rsa.h>
 #include <openssl/rand.h>
@@ -44,7 +51,7 @@ DEFINE_CLEANUP_FUNCTION_NULL(BN_CTX*, BN_CTX_free)
 DEFINE_CLEANUP_FUNCTION_NULL(BIGNUM*, BN_free)
 #define gc_bn_free CLEANUP(BN_free)
 
-#define CACHE_FORMAT_VERSION 3
+#define CACHE_FORMAT_VERSION 4
 #define PROGRESS_FREQUENCY ((gint64)2e6)
 #define PROGRESS_ONESEC ((gint64)1e6)
 
@@ -102,12 +109,13 @@ struct _rsa_key {
 // }}}
 // {{{ mega_session
 
-struct _mega_sesssion 
+struct _mega_sesssion
 {
   http* http;
 
   gint max_ul;
   gint max_dl;
+  gint max_workers;
   gchar* proxy;
 
   gint id;
@@ -127,15 +135,32 @@ struct _mega_sesssion
 
   GSList* fs_nodes;
 
+  // lookup indexes rebuilt by update_pathmap: remote path -> node, and
+  // parent handle -> GSList of children
+  GHashTable* path_map;
+  GHashTable* children_map;
+
   // progress reporting
   mega_status_callback status_callback;
-  mega_status_data status_data;
   gpointer status_userdata;
 
   gint64 last_refresh;
+  gchar* sn; // last seen sequence number, for delta refresh
   gint64 last_progress;
   guint64 last_progress_bytes;
+  GMutex status_lock; // guards the progress rate limiter state above
   gboolean create_preview;
+  gboolean use_pkey_cache;
+  gboolean narrowed; // tree was restricted by mega_session_narrow
+
+  // batched API command submission
+  gboolean batch_active;
+  gint batch_count;
+  GString* batch_req;
+
+  // serializes API calls and node tree access when transfers run from
+  // multiple threads (megacopy --parallel)
+  GMutex lock;
 };
 
 // }}}
@@ -294,59 +319,28 @@ static void s_json_gen_member_rsa_key(SJsonGen* gen, const gchar* name, rsa_key*
 
 static gchar* base64urlencode(const guchar* data, gsize len)
 {
-  gint i, shl;
-  gchar *she, *p;
-
   g_return_val_if_fail(data != NULL, NULL);
   g_return_val_if_fail(len > 0, NULL);
 
-  gc_free gchar* sh = g_base64_encode(data, len);
-  shl = strlen(sh);
-
-  she = g_malloc0(shl + 1), p = she;
-  for (i = 0; i < shl; i++)
-  {
-    if (sh[i] == '+')
-      *p = '-';
-    else if (sh[i] == '/')
-      *p = '_';
-    else if (sh[i] == '=')
-      continue;
-    else
-      *p = sh[i];
-    p++;
-  }
-
-  *p = '\0';
-
-  return she;
+  return b64_urlencode(data, len);
 }
 
 // }}}
 // {{{ base64urldecode
 
-static guchar* base64urldecode(const gchar* str, gsize* len)
+static guchar* base64urldecode_len(const gchar* str, gsize str_len, gsize* len)
 {
-  gint i;
-
   g_return_val_if_fail(str != NULL, NULL);
   g_return_val_if_fail(len != NULL, NULL);
 
-  gc_string_free GString* s = g_string_new(str);
-
-  for (i = 0; i < s->len; i++)
-  {
-    if (s->str[i] == '-')
-      s->str[i] = '+';
-    else if (s->str[i] == '_')
-      s->str[i] = '/';
-  }
+  return b64_urldecode(str, str_len, len);
+}
 
-  gint eqs = (s->len * 3) & 0x03;
-  for (i = 0; i < eqs; i++)
-    g_string_append_c(s, '=');
+static guchar* base64urldecode(const gchar* str, gsize* len)
+{
+  g_return_val_if_fail(str != NULL, NULL);
 
-  return g_base64_decode(s->str, len);
+  return base64urldecode_len(str, strlen(str), len);
 }
 
 // }}}
@@ -394,7 +388,7 @@ static gboolean aes128_encrypt(guchar* out, const guchar* in, gsize len, const g
 // }}}
 // {{{ b64_aes128_decrypt
 
-static guchar* b64_aes128_decrypt(const gchar* str, const guchar* key, gsize* outlen)
+static guchar* b64_aes128_decrypt_len(const gchar* str, gsize str_len, const guchar* key, gsize* outlen)
 {
   AES_KEY k;
   gsize cipherlen = 0;
@@ -407,7 +401,7 @@ static guchar* b64_aes128_decrypt(const gchar* str, const guchar* key, gsize* ou
 
   AES_set_decrypt_key(key, 128, &k);
 
-  cipher = base64urldecode(str, &cipherlen);
+  cipher = base64urldecode_len(str, str_len, &cipherlen);
   if (cipher == NULL)
     return NULL;
 
@@ -424,6 +418,13 @@ static guchar* b64_aes128_decrypt(const gchar* str, const guchar* key, gsize* ou
   return data;
 }
 
+static guchar* b64_aes128_decrypt(const gchar* str, const guchar* key, gsize* outlen)
+{
+  g_return_val_if_fail(str != NULL, NULL);
+
+  return b64_aes128_decrypt_len(str, strlen(str), key, outlen);
+}
+
 // }}}
 // {{{ b64_aes128_encrypt
 
@@ -450,7 +451,7 @@ static gchar* b64_aes128_encrypt(const guchar* data, gsize len, const guchar* ke
 // }}}
 // {{{ b64_aes128_cbc_decrypt
 
-static guchar* b64_aes128_cbc_decrypt(const gchar* str, const guchar* key, gsize* outlen)
+static guchar* b64_aes128_cbc_decrypt_len(const gchar* str, gsize str_len, const guchar* key, gsize* outlen)
 {
   AES_KEY k;
   gsize cipherlen = 0;
@@ -462,7 +463,7 @@ static guchar* b64_aes128_cbc_decrypt(const gchar* str, const guchar* key, gsize
 
   AES_set_decrypt_key(key, 128, &k);
 
-  cipher = base64urldecode(str, &cipherlen);
+  cipher = base64urldecode_len(str, str_len, &cipherlen);
   if (cipher == NULL)
     return NULL;
 
@@ -479,6 +480,13 @@ static guchar* b64_aes128_cbc_decrypt(const gchar* str, const guchar* key, gsize
   return data;
 }
 
+static guchar* b64_aes128_cbc_decrypt(const gchar* str, const guchar* key, gsize* outlen)
+{
+  g_return_val_if_fail(str != NULL, NULL);
+
+  return b64_aes128_cbc_decrypt_len(str, strlen(str), key, outlen);
+}
+
 // }}}
 // {{{ b64_aes128_cbc_encrypt
 
@@ -876,6 +884,8 @@ static guchar* make_password_key(const gchar* password)
 
   g_return_val_if_fail(password != NULL, NULL);
 
+  MEGA_PROFILE_BEGIN(span);
+
   len = strlen(password);
 
   for (r = 65536; r--; )
@@ -892,9 +902,85 @@ static guchar* make_password_key(const gchar* password)
     }
   }
 
+  MEGA_PROFILE_END(span, "crypto.pbkdf", 0);
+
   return g_memdup(pkey, 16);
 }
 
+// }}}
+// {{{ password key cache
+
+// The derived password key is cached next to the session cache so warm
+// starts skip the 65536-round KDF (noticeable on low-power CPUs). The key
+// is password-equivalent for the account, exactly like the session cache
+// contents, so it gets the same protection: an owner-only file in the tmp
+// dir. A salted SHA1 verifier ties the cached key to the password that
+// derived it, so a changed password transparently falls back to the KDF.
+
+#define PKEY_CACHE_SIZE (1 + 16 + 20 + 16) // version + salt + verifier + key
+
+static gchar* pkey_cache_path(const gchar* un_lower)
+{
+  gc_checksum_free GChecksum* cs = g_checksum_new(G_CHECKSUM_SHA1);
+  g_checksum_update(cs, un_lower, -1);
+  gc_free gchar* filename = g_strconcat(g_checksum_get_string(cs), ".megatools.pkey", NULL);
+
+  return g_build_filename(g_get_tmp_dir(), filename, NULL);
+}
+
+static void pkey_cache_verifier(const guchar* salt, const gchar* un_lower, const gchar* pw, guchar verifier[20])
+{
+  gc_checksum_free GChecksum* cs = g_checksum_new(G_CHECKSUM_SHA1);
+  gsize len = 20;
+
+  g_checksum_update(cs, salt, 16);
+  g_checksum_update(cs, un_lower, -1);
+  g_checksum_update(cs, pw, -1);
+  g_checksum_get_digest(cs, verifier, &len);
+}
+
+static guchar* pkey_cache_load(mega_session* s, const gchar* un_lower, const gchar* pw)
+{
+  gc_free gchar* data = NULL;
+  guchar verifier[20];
+  gsize len = 0;
+
+  if (!s->use_pkey_cache)
+    return NULL;
+
+  gc_free gchar* path = pkey_cache_path(un_lower);
+  if (!g_file_get_contents(path, &data, &len, NULL))
+    return NULL;
+
+  if (len != PKEY_CACHE_SIZE || data[0] != 1)
+    return NULL;
+
+  pkey_cache_verifier((guchar*)data + 1, un_lower, pw, verifier);
+  if (memcmp(data + 1 + 16, verifier, 20) != 0)
+    return NULL;
+
+  return g_memdup(data + 1 + 16 + 20, 16);
+}
+
+static void pkey_cache_save(mega_session* s, const gchar* un_lower, const gchar* pw, const guchar* key)
+{
+  guchar buf[PKEY_CACHE_SIZE];
+
+  if (!s->use_pkey_cache)
+    return;
+
+  buf[0] = 1;
+  if (!RAND_bytes(buf + 1, 16))
+    return;
+
+  pkey_cache_verifier(buf + 1, un_lower, pw, buf + 1 + 16);
+  memcpy(buf + 1 + 16 + 20, key, 16);
+
+  gc_free gchar* path = pkey_cache_path(un_lower);
+  if (g_file_set_contents(path, (gchar*)buf, sizeof(buf), NULL))
+    g_chmod(path, 0600);
+}
+
 // }}}
 // {{{ make_username_hash
 
@@ -947,18 +1033,16 @@ static guint64 get_chunk_size(gsize idx)
   return (idx < 8 ? idx + 1 : 8) * 1024 * 128;
 }
 
-/*
-static gsize get_chunk_off(gint idx)
+static guint64 get_chunk_off(gsize idx)
 {
-  gsize p = 0;
-  gint i = 0;
+  guint64 p = 0;
+  gsize i = 0;
 
   for (i = 0; i < idx; i++)
     p += get_chunk_size(i);
 
   return p;
 }
-*/
 
 typedef struct 
 {
@@ -1158,17 +1242,24 @@ static gboolean decode_node_attrs(const gchar* attrs, gchar** name)
 // }}}
 // {{{ decrypt_node_attrs
 
-static gboolean decrypt_node_attrs(const gchar* encrypted_attrs, const guchar* key, gchar** name)
+static gboolean decrypt_node_attrs_len(const gchar* encrypted_attrs, gsize attrs_len, const guchar* key, gchar** name)
 {
   g_return_val_if_fail(encrypted_attrs != NULL, FALSE);
   g_return_val_if_fail(key != NULL, FALSE);
   g_return_val_if_fail(name != NULL, FALSE);
 
-  gc_free guchar* attrs = b64_aes128_cbc_decrypt(encrypted_attrs, key, NULL);
+  gc_free guchar* attrs = b64_aes128_cbc_decrypt_len(encrypted_attrs, attrs_len, key, NULL);
 
   return decode_node_attrs(attrs, name);
 }
 
+static gboolean decrypt_node_attrs(const gchar* encrypted_attrs, const guchar* key, gchar** name)
+{
+  g_return_val_if_fail(encrypted_attrs != NULL, FALSE);
+
+  return decrypt_node_attrs_len(encrypted_attrs, strlen(encrypted_attrs), key, name);
+}
+
 // }}}
 // {{{ handle_auth
 
@@ -1221,7 +1312,77 @@ static const gchar* srv_error_to_string(gint code)
 }
 
 // }}}
+// {{{ API endpoint pool
+
+// MEGA runs several API front-ends; when one degrades, sticking to it
+// stalls every command. The pool tracks a latency EMA and a failure
+// count per endpoint and routes commands to the healthiest one; a
+// penalized endpoint is retried again once its competitors fail or its
+// record ages out through new measurements.
+
+static const gchar* const api_endpoints[] = {
+  "eu.api.mega.co.nz",
+  "g.api.mega.co.nz",
+};
+
+#define API_ENDPOINT_COUNT G_N_ELEMENTS(api_endpoints)
+
+static GMutex api_pool_lock;
+static gdouble api_latency_ema[API_ENDPOINT_COUNT]; // us, 0 = unmeasured
+static gint api_failures[API_ENDPOINT_COUNT];
+static gint api_current;
+
+// pick the endpoint with the best failure-weighted latency
+static void api_endpoint_elect_locked(void)
+{
+  gdouble best_score = 0;
+  gint i, best = api_current;
+
+  for (i = 0; i < API_ENDPOINT_COUNT; i++)
+  {
+    // unmeasured endpoints score as fast, so they get probed
+    gdouble score = (api_latency_ema[i] > 0 ? api_latency_ema[i] : 1) * (1 + api_failures[i]);
+
+    if (best_score == 0 || score < best_score)
+    {
+      best_score = score;
+      best = i;
+    }
+  }
+
+  api_current = best;
+}
+
+static const gchar* api_endpoint_get(void)
+{
+  const gchar* host;
+
+  g_mutex_lock(&api_pool_lock);
+  host = api_endpoints[api_current];
+  g_mutex_unlock(&api_pool_lock);
+
+  return host;
+}
+
+static void api_endpoint_report(gint64 latency_us, gboolean ok)
+{
+  g_mutex_lock(&api_pool_lock);
+
+  if (ok)
+  {
+    gdouble* ema = &api_latency_ema[api_current];
 
+    *ema = *ema > 0 ? *ema * 0.8 + latency_us * 0.2 : latency_us;
+    api_failures[api_current] = 0;
+  }
+  else
+    api_failures[api_current]++;
+
+  api_endpoint_elect_locked();
+  g_mutex_unlock(&api_pool_lock);
+}
+
+// }}}
 // {{{ api_request_unsafe
 
 static gchar* api_request_unsafe(mega_session* s, const gchar* req_node, GError** err)
@@ -1239,11 +1400,13 @@ static gchar* api_request_unsafe(mega_session* s, const gchar* req_node, GError*
   // prepare URL
   s->id++;
   if (s->sid)
-    url = g_strdup_printf("https://eu.api.mega.co.nz/cs?id=%u&%s=%s", s->id, s->sid_param_name ? s->sid_param_name : "sid", s->sid);
+    url = g_strdup_printf("https://%s/cs?id=%u&%s=%s", api_endpoint_get(), s->id, s->sid_param_name ? s->sid_param_name : "sid", s->sid);
   else
-    url = g_strdup_printf("https://eu.api.mega.co.nz/cs?id=%u", s->id);
+    url = g_strdup_printf("https://%s/cs?id=%u", api_endpoint_get(), s->id);
 
+  gint64 start = g_get_monotonic_time();
   GString* res_str = http_post(s->http, url, req_node, strlen(req_node), &local_err);
+  api_endpoint_report(g_get_monotonic_time() - start, res_str != NULL);
 
   // handle http errors
   if (!res_str)
@@ -1284,6 +1447,7 @@ static gchar* api_request(mega_session* s, const gchar* req_node, GError** err)
   GError* local_err = NULL;
   gchar* response;
   gint delay = 250000; // repeat after 250ms 500ms 1s ...
+  gboolean failed_over = FALSE;
 
   g_return_val_if_fail(s != NULL, NULL);
   g_return_val_if_fail(req_node != NULL, NULL);
@@ -1293,8 +1457,12 @@ static gchar* api_request(mega_session* s, const gchar* req_node, GError** err)
   g_usleep(20000);
 
 again:
+  MEGA_PROFILE_BEGIN(span);
+  g_mutex_lock(&s->lock);
   response = api_request_unsafe(s, req_node, &local_err);
-  if (!response) 
+  g_mutex_unlock(&s->lock);
+  MEGA_PROFILE_END(span, "api.call", response ? strlen(response) : 0);
+  if (!response)
   {
     g_propagate_error(err, local_err);
     return NULL;
@@ -1304,7 +1472,21 @@ again:
   if (s_json_get_type(response) == S_JSON_TYPE_NUMBER && s_json_get_int(response, SRV_EINTERNAL) == SRV_EAGAIN)
   {
     g_free(response);
-    g_usleep(delay);
+
+    // EAGAIN is an endpoint health signal too, the pool may elect a
+    // healthier front-end for the retry
+    api_endpoint_report(0, FALSE);
+
+    // retry once immediately when there is another endpoint to try,
+    // before falling back to timed waits
+    if (!failed_over && API_ENDPOINT_COUNT > 1)
+    {
+      failed_over = TRUE;
+      goto again;
+    }
+
+    // jitter desynchronizes parallel jobs hammering a busy server
+    g_usleep(delay + g_random_int_range(0, delay / 2 + 1));
     delay = delay * 2;
 
     if (delay > 4 * 64 * 1000 * 1000)
@@ -1436,6 +1618,34 @@ static gchar* api_call(mega_session* s, gchar expects, gint* error_code, GError*
     return NULL;
   }
 
+  // when a batch is active, queue the command instead of submitting it;
+  // results are only known at mega_session_batch_commit time, so report
+  // optimistic success to the caller
+  if (s->batch_active)
+  {
+    const gchar* cmd = s_json_get_element(request, 0);
+    if (!cmd)
+    {
+      g_set_error(err, MEGA_ERROR, MEGA_ERROR_OTHER, "Invalid request format: %s", format);
+      return NULL;
+    }
+
+    gc_free gchar* cmd_str = s_json_get(cmd);
+    if (s->batch_count++ > 0)
+      g_string_append_c(s->batch_req, ',');
+    g_string_append(s->batch_req, cmd_str);
+
+    switch (expects)
+    {
+      case 'i': return g_strdup("0");
+      case 'b': return g_strdup("true");
+      case 'n': return g_strdup("null");
+      default:
+        g_set_error(err, MEGA_ERROR, MEGA_ERROR_OTHER, "API call expecting '%c' response can't be batched", expects);
+        return NULL;
+    }
+  }
+
   gc_free gchar* response = api_request(s, request, err);
 
   node = api_response_check(response, expects, error_code, err);
@@ -1458,6 +1668,88 @@ static gchar* api_call(mega_session* s, gchar expects, gint* error_code, GError*
   return s_json_get(node);
 }
 
+// }}}
+// {{{ mega_session_batch_begin
+
+// Batched API command submission: between begin and commit, api_call
+// queues commands instead of posting them, and commit submits the whole
+// queue as a single command array, amortizing the round-trip over many
+// commands. Only calls whose response the caller ignores beyond
+// success/failure (expects 'i', 'b' or 'n') can be batched.
+
+void mega_session_batch_begin(mega_session* s)
+{
+  g_return_if_fail(s != NULL);
+  g_return_if_fail(!s->batch_active);
+
+  s->batch_active = TRUE;
+  s->batch_count = 0;
+  s->batch_req = g_string_new("[");
+}
+
+// }}}
+// {{{ mega_session_batch_commit
+
+gboolean mega_session_batch_commit(mega_session* s, GError** err)
+{
+  GError* local_err = NULL;
+  gint i, count;
+
+  g_return_val_if_fail(s != NULL, FALSE);
+  g_return_val_if_fail(s->batch_active, FALSE);
+  g_return_val_if_fail(err == NULL || *err == NULL, FALSE);
+
+  s->batch_active = FALSE;
+  count = s->batch_count;
+  s->batch_count = 0;
+
+  g_string_append_c(s->batch_req, ']');
+  gc_free gchar* request = g_string_free(s->batch_req, FALSE);
+  s->batch_req = NULL;
+
+  if (count == 0)
+    return TRUE;
+
+  gc_free gchar* response = api_request(s, request, &local_err);
+  if (!response)
+  {
+    g_propagate_prefixed_error(err, local_err, "Batched API call failed: ");
+    return FALSE;
+  }
+
+  // request level error
+  if (s_json_get_type(response) == S_JSON_TYPE_NUMBER)
+  {
+    gint v = s_json_get_int(response, 0);
+    if (v < 0)
+    {
+      g_set_error(err, MEGA_ERROR, MEGA_ERROR_OTHER, "Batched API call failed: %s", srv_error_to_string(v));
+      return FALSE;
+    }
+  }
+
+  // per-command error codes
+  if (s_json_get_type(response) == S_JSON_TYPE_ARRAY)
+  {
+    for (i = 0; i < count; i++)
+    {
+      const gchar* node = s_json_get_element(response, i);
+
+      if (node && s_json_get_type(node) == S_JSON_TYPE_NUMBER)
+      {
+        gint v = s_json_get_int(node, 0);
+        if (v < 0)
+        {
+          g_set_error(err, MEGA_ERROR, MEGA_ERROR_OTHER, "Batched command %d failed: %s", i + 1, srv_error_to_string(v));
+          return FALSE;
+        }
+      }
+    }
+  }
+
+  return TRUE;
+}
+
 // }}}
 
 // Remote filesystem helpers
@@ -1466,11 +1758,46 @@ static gchar* api_call(mega_session* s, gchar expects, gint* error_code, GError*
 
 static void mega_node_free(mega_node* n);
 
+static void free_children_list(gchar* handle, GSList* children, gpointer data)
+{
+  g_slist_free(children);
+}
+
+static void pathmap_clear(mega_session* s)
+{
+  if (s->path_map)
+  {
+    g_hash_table_unref(s->path_map);
+    s->path_map = NULL;
+  }
+
+  if (s->children_map)
+  {
+    g_hash_table_foreach(s->children_map, (GHFunc)free_children_list, NULL);
+    g_hash_table_unref(s->children_map);
+    s->children_map = NULL;
+  }
+}
+
+// add a single node to the indexes (parent must be resolved already)
+static void pathmap_insert_node(mega_session* s, mega_node* n)
+{
+  gchar path[4096];
+
+  if (s->path_map && mega_node_get_path(n, path, sizeof(path)) && !g_hash_table_contains(s->path_map, path))
+    g_hash_table_insert(s->path_map, g_strdup(path), n);
+
+  if (s->children_map && n->parent_handle)
+    g_hash_table_insert(s->children_map, n->parent_handle, g_slist_append(g_hash_table_lookup(s->children_map, n->parent_handle), n));
+}
+
 static void update_pathmap(mega_session* s)
 {
   GSList *i, *next;
   g_return_if_fail(s != NULL);
 
+  MEGA_PROFILE_BEGIN(span);
+
   // node handles are assumed to be unique
   GHashTable* handle_map = g_hash_table_new(g_str_hash, g_str_equal);
   for (i = s->fs_nodes; i; i = i->next)
@@ -1525,6 +1852,32 @@ static void update_pathmap(mega_session* s)
   }
 
   g_hash_table_unref(handle_map);
+
+  // rebuild the path and children indexes (parents are resolved now)
+  pathmap_clear(s);
+  s->path_map = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  s->children_map = g_hash_table_new(g_str_hash, g_str_equal);
+
+  for (i = s->fs_nodes; i; i = i->next)
+  {
+    mega_node* n = i->data;
+    gchar path[4096];
+
+    if (mega_node_get_path(n, path, sizeof(path)) && !g_hash_table_contains(s->path_map, path))
+      g_hash_table_insert(s->path_map, g_strdup(path), n);
+
+    if (n->parent_handle)
+      g_hash_table_insert(s->children_map, n->parent_handle, g_slist_prepend(g_hash_table_lookup(s->children_map, n->parent_handle), n));
+  }
+
+  // children were prepended, restore the fs_nodes order
+  GHashTableIter iter;
+  gpointer children;
+  g_hash_table_iter_init(&iter, s->children_map);
+  while (g_hash_table_iter_next(&iter, NULL, &children))
+    g_hash_table_iter_replace(&iter, g_slist_reverse(children));
+
+  MEGA_PROFILE_END(span, "fs.pathmap", 0);
 }
 
 // {{{ update_pathmap_prune
@@ -1585,6 +1938,10 @@ static void update_pathmap_prune(mega_session* s, const gchar* specific)
     s->fs_nodes = g_slist_remove(s->fs_nodes, r);
     mega_node_free(r);
   }
+
+  // drop the removed nodes from the indexes
+  if (remove_nodes->len > 0)
+    update_pathmap(s);
 }
 
 // }}}
@@ -1715,17 +2072,20 @@ static gboolean get_partial_file_offset(GFile* file, goffset* resume_from, GErro
 
 // {{{ send_status
 
-static void init_status(mega_session* s, gint type)
+// the status struct lives on the caller's stack, so that transfers running
+// concurrently on a shared session (megacopy --parallel) don't race on it
+
+static void init_status(mega_status_data* d, gint type)
 {
-  memset(&s->status_data, 0, sizeof(s->status_data));
-  s->status_data.type = type;
+  memset(d, 0, sizeof(*d));
+  d->type = type;
 }
 
 // true to interrupt
-static gboolean send_status(mega_session* s)
+static gboolean send_status(mega_session* s, mega_status_data* d)
 {
   if (s->status_callback) 
-    return s->status_callback(&s->status_data, s->status_userdata);
+    return s->status_callback(d, s->status_userdata);
 
   return FALSE;
 }
@@ -1745,19 +2105,100 @@ void add_share_key(mega_session* s, const gchar* handle, const guchar* key)
 // }}}
 // {{{ mega_node_parse
 
+// decrypt and register a node's share key, unless it's already known
+static void process_share_key(mega_session* s, const gchar* node_h, const gchar* node_sk)
+{
+  gsize share_key_len;
+  gc_free guchar* share_key = NULL;
+
+  if (g_hash_table_lookup(s->share_keys, node_h))
+    return;
+
+  if (strlen(node_sk) > 22)
+  {
+    share_key = b64_rsa_decrypt(node_sk, &s->rsa_key, &share_key_len);
+    if (share_key && share_key_len >= 16)
+      add_share_key(s, node_h, share_key);
+  }
+  else
+  {
+    share_key = b64_aes128_decrypt(node_sk, s->master_key, &share_key_len);
+    if (share_key && share_key_len == 16)
+      add_share_key(s, node_h, share_key);
+  }
+}
+
+// register a node's share key (if any); mega_session_refresh runs this
+// serially over the whole 'f' array so the share key table is read-only
+// during parallel node parsing
+static void mega_node_parse_share_key(mega_session* s, const gchar* node)
+{
+  gc_free gchar* node_h = NULL;
+  gc_free gchar* node_sk = NULL;
+
+  S_JSON_FOREACH_MEMBER(node, k, v)
+    if (s_json_string_match(k, "h"))
+      node_h = s_json_get_string(v);
+    else if (s_json_string_match(k, "sk"))
+      node_sk = s_json_get_string(v);
+  S_JSON_FOREACH_END()
+
+  if (node_h && node_sk && strlen(node_sk) > 0)
+    process_share_key(s, node_h, node_sk);
+}
+
 static mega_node* mega_node_parse(mega_session* s, const gchar* node)
 {
   gchar* tmp;
-  gc_free gchar* node_h = s_json_get_member_string(node, "h");
-  gc_free gchar* node_p = s_json_get_member_string(node, "p");
-  gc_free gchar* node_u = s_json_get_member_string(node, "u");
-  gc_free gchar* node_k = s_json_get_member_string(node, "k");
-  gc_free gchar* node_a = s_json_get_member_string(node, "a");
-  gc_free gchar* node_sk = s_json_get_member_string(node, "sk");
-  gc_free gchar* node_su = s_json_get_member_string(node, "su");
-  gint node_t = s_json_get_member_int(node, "t", -1);
-  gint64 node_ts = s_json_get_member_int(node, "ts", 0);
-  gint64 node_s = s_json_get_member_int(node, "s", 0);
+  gc_free gchar* node_h = NULL;
+  gc_free gchar* node_p = NULL;
+  gc_free gchar* node_u = NULL;
+  gc_free gchar* node_sk = NULL;
+  gc_free gchar* node_su = NULL;
+  gint node_t = -1;
+  gint64 node_ts = 0;
+  gint64 node_s = 0;
+
+  // 'k' and 'a' are only needed during parsing, view them in place instead
+  // of copying (falling back to a copy for strings with escapes)
+  const gchar* node_k = NULL;
+  const gchar* node_a = NULL;
+  gsize node_k_len = 0, node_a_len = 0;
+  gc_free gchar* node_k_buf = NULL;
+  gc_free gchar* node_a_buf = NULL;
+
+  // gather members in one pass, looking up each member separately rescans
+  // the object from the start
+  S_JSON_FOREACH_MEMBER(node, k, v)
+    if (s_json_string_match(k, "h"))
+      node_h = s_json_get_string(v);
+    else if (s_json_string_match(k, "p"))
+      node_p = s_json_get_string(v);
+    else if (s_json_string_match(k, "u"))
+      node_u = s_json_get_string(v);
+    else if (s_json_string_match(k, "k"))
+    {
+      node_k = s_json_string_view(v, &node_k_len);
+      if (!node_k && (node_k = node_k_buf = s_json_get_string(v)))
+        node_k_len = strlen(node_k);
+    }
+    else if (s_json_string_match(k, "a"))
+    {
+      node_a = s_json_string_view(v, &node_a_len);
+      if (!node_a && (node_a = node_a_buf = s_json_get_string(v)))
+        node_a_len = strlen(node_a);
+    }
+    else if (s_json_string_match(k, "sk"))
+      node_sk = s_json_get_string(v);
+    else if (s_json_string_match(k, "su"))
+      node_su = s_json_get_string(v);
+    else if (s_json_string_match(k, "t"))
+      node_t = s_json_get_int(v, -1);
+    else if (s_json_string_match(k, "ts"))
+      node_ts = s_json_get_int(v, 0);
+    else if (s_json_string_match(k, "s"))
+      node_s = s_json_get_int(v, 0);
+  S_JSON_FOREACH_END()
 
   // sanity check parsed values
   if (!node_h || strlen(node_h) == 0)
@@ -1803,14 +2244,14 @@ static mega_node* mega_node_parse(mega_session* s, const gchar* node)
   }
 
   // node has to have attributes
-  if (!node_a || strlen(node_a) == 0)
+  if (!node_a || node_a_len == 0)
   {
     g_printerr("WARNING: Skipping FS node %s without attributes\n", node_h);
     return NULL;
   }
 
   // node has to have a key
-  if (!node_k || strlen(node_k) == 0)
+  if (!node_k || node_k_len == 0)
   {
     g_printerr("WARNING: Skipping FS node %s because of missing node key\n", node_h);
     return NULL;
@@ -1818,52 +2259,52 @@ static mega_node* mega_node_parse(mega_session* s, const gchar* node)
 
   // process sk if available
   if (node_sk && strlen(node_sk) > 0)
-  {
-    gsize share_key_len;
-    gc_free guchar* share_key = NULL;
-
-    if (strlen(node_sk) > 22)
-    {
-      share_key = b64_rsa_decrypt(node_sk, &s->rsa_key, &share_key_len);
-      if (share_key && share_key_len >= 16)
-        add_share_key(s, node_h, share_key);
-    }
-    else
-    {
-      share_key = b64_aes128_decrypt(node_sk, s->master_key, &share_key_len);
-      if (share_key && share_key_len == 16)
-        add_share_key(s, node_h, share_key);
-    }
-  }
+    process_share_key(s, node_h, node_sk);
 
   gchar* node_share_key = NULL;
-  gc_free gchar* encrypted_node_key = NULL;
-  gc_strfreev gchar** parts = g_strsplit(node_k, "/", 0);
-  gint i;
+  const gchar* encrypted_node_key = NULL;
+  gsize encrypted_node_key_len = 0;
+  const gchar* part = node_k;
+  const gchar* node_k_end = node_k + node_k_len;
 
-  for (i = 0; parts[i]; i++)
+  // split node keys in place
+  while (part < node_k_end)
   {
-    // split node keys
-    gchar* key_value = strchr(parts[i], ':');
+    const gchar* part_end = memchr(part, '/', node_k_end - part);
+    if (!part_end)
+      part_end = node_k_end;
+
+    const gchar* key_value = memchr(part, ':', part_end - part);
     if (key_value)
     {
-      gchar* key_handle = parts[i];
-      *key_value = '\0'; key_value++;
+      gchar key_handle[32];
+      gsize key_handle_len = key_value - part;
+      key_value++;
 
-      if (s->user_handle && !strcmp(s->user_handle, key_handle))
+      if (key_handle_len < sizeof(key_handle))
       {
-        // we found a key encrypted by me
-        encrypted_node_key = g_strdup(key_value);
-        node_share_key = s->master_key;
-        break;
-      }
+        memcpy(key_handle, part, key_handle_len);
+        key_handle[key_handle_len] = '\0';
 
-      node_share_key = g_hash_table_lookup(s->share_keys, key_handle);
-      if (node_share_key)
-      {
-        encrypted_node_key = g_strdup(key_value);
+        if (s->user_handle && !strcmp(s->user_handle, key_handle))
+        {
+          // we found a key encrypted by me
+          encrypted_node_key = key_value;
+          encrypted_node_key_len = part_end - key_value;
+          node_share_key = s->master_key;
+          break;
+        }
+
+        node_share_key = g_hash_table_lookup(s->share_keys, key_handle);
+        if (node_share_key)
+        {
+          encrypted_node_key = key_value;
+          encrypted_node_key_len = part_end - key_value;
+        }
       }
     }
+
+    part = part_end + 1;
   }
 
   if (!encrypted_node_key)
@@ -1873,7 +2314,7 @@ static mega_node* mega_node_parse(mega_session* s, const gchar* node)
   }
 
   // keys longer than 45 chars are RSA keys
-  if (strlen(encrypted_node_key) >= 46)
+  if (encrypted_node_key_len >= 46)
   {
     g_printerr("WARNING: Skipping FS node %s because it has RSA key\n", node_h);
     return NULL;
@@ -1881,10 +2322,10 @@ static mega_node* mega_node_parse(mega_session* s, const gchar* node)
 
   // decrypt node key
   gsize node_key_len = 0;
-  gc_free guchar* node_key = b64_aes128_decrypt(encrypted_node_key, node_share_key, &node_key_len);
+  gc_free guchar* node_key = b64_aes128_decrypt_len(encrypted_node_key, encrypted_node_key_len, node_share_key, &node_key_len);
   if (!node_key)
   {
-    g_printerr("WARNING: Skipping FS node %s because key can't be decrypted %s\n", node_h, encrypted_node_key);
+    g_printerr("WARNING: Skipping FS node %s because key can't be decrypted %.*s\n", node_h, (int)encrypted_node_key_len, encrypted_node_key);
     return NULL;
   }
 
@@ -1908,7 +2349,7 @@ static mega_node* mega_node_parse(mega_session* s, const gchar* node)
     memcpy(aes_key, node_key, 16);
 
   gc_free gchar* node_name = NULL;
-  if (!decrypt_node_attrs(node_a, aes_key, &node_name))
+  if (!decrypt_node_attrs_len(node_a, node_a_len, aes_key, &node_name))
   {
     g_printerr("WARNING: Skipping FS node %s because it has malformed attributes\n", node_h);
     return NULL;
@@ -1955,9 +2396,18 @@ static mega_node* mega_node_parse(mega_session* s, const gchar* node)
 
 static mega_node* mega_node_parse_user(mega_session* s, const gchar* node)
 {
-  gc_free gchar* node_u = s_json_get_member_string(node, "u");
-  gc_free gchar* node_m = s_json_get_member_string(node, "m");
-  gint64 node_ts = s_json_get_member_int(node, "ts", 0);
+  gc_free gchar* node_u = NULL;
+  gc_free gchar* node_m = NULL;
+  gint64 node_ts = 0;
+
+  S_JSON_FOREACH_MEMBER(node, k, v)
+    if (s_json_string_match(k, "u"))
+      node_u = s_json_get_string(v);
+    else if (s_json_string_match(k, "m"))
+      node_m = s_json_get_string(v);
+    else if (s_json_string_match(k, "ts"))
+      node_ts = s_json_get_int(v, 0);
+  S_JSON_FOREACH_END()
 
   // sanity check parsed values
   if (!node_u || strlen(node_u) == 0)
@@ -2037,9 +2487,14 @@ mega_session* mega_session_new(void)
 
   s->id = time(NULL);
   s->rid = make_request_id();
+  s->max_workers = 1;
+  s->use_pkey_cache = TRUE;
 
   s->share_keys = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
 
+  g_mutex_init(&s->lock);
+  g_mutex_init(&s->status_lock);
+
   return s;
 }
 
@@ -2050,10 +2505,22 @@ void mega_session_set_speed(mega_session* s, gint ul, gint dl)
 {
   s->max_ul = ul;
   s->max_dl = dl;
+
+  // the limit is an aggregate budget shared by all connections, not a
+  // per-connection one
+  http_set_speed_global(ul, dl);
 }
 
 // }}}
-// {{{ mega_session_set_proxy
+// {{{ mega_session_set_workers
+
+void mega_session_set_workers(mega_session* s, gint workers)
+{
+  s->max_workers = CLAMP(workers, 1, 64);
+}
+
+// }}}
+// {{{ mega_session_set_proxy
 
 void mega_session_set_proxy(mega_session* s, const gchar* proxy)
 {
@@ -2070,6 +2537,7 @@ void mega_session_free(mega_session* s)
   if (s)
   {
     http_free(s->http);
+    pathmap_clear(s);
     g_slist_free_full(s->fs_nodes, (GDestroyNotify)mega_node_free);
     g_hash_table_destroy(s->share_keys);
     g_free(s->sid);
@@ -2080,6 +2548,11 @@ void mega_session_free(mega_session* s)
     g_free(s->user_handle);
     g_free(s->user_name);
     g_free(s->user_email);
+    g_free(s->sn);
+    if (s->batch_req)
+      g_string_free(s->batch_req, TRUE);
+    g_mutex_clear(&s->lock);
+    g_mutex_clear(&s->status_lock);
     memset(s, 0, sizeof(mega_session));
     g_free(s);
   }
@@ -2106,6 +2579,16 @@ void mega_session_enable_previews(mega_session* s, gboolean enable)
   s->create_preview = enable;
 }
 
+// }}}
+// {{{ mega_session_enable_pkey_cache
+
+void mega_session_enable_pkey_cache(mega_session* s, gboolean enable)
+{
+  g_return_if_fail(s != NULL);
+
+  s->use_pkey_cache = enable;
+}
+
 // }}}
 
 // {{{ mega_session_open_exp_folder
@@ -2196,9 +2679,18 @@ gboolean mega_session_open(mega_session* s, const gchar* un, const gchar* pw, co
 
   //g_print("%s %s %s\n", un, pw, sid);
 
-  // make password key
+  // make password key, reusing the cached derived key when available
   g_free(s->password_key);
-  s->password_key = make_password_key(pw);
+  {
+    gc_free gchar* un_lower = g_ascii_strdown(un, -1);
+
+    s->password_key = pkey_cache_load(s, un_lower, pw);
+    if (!s->password_key)
+    {
+      s->password_key = make_password_key(pw);
+      pkey_cache_save(s, un_lower, pw, s->password_key);
+    }
+  }
 
   // if we have existing session id, just check with the server if session is
   // active, and download keys and user info
@@ -2286,10 +2778,13 @@ void mega_session_close(mega_session* s)
   g_free(s->user_name);
   g_free(s->user_email);
 
+  pathmap_clear(s);
   g_slist_free_full(s->fs_nodes, (GDestroyNotify)mega_node_free);
 
   g_hash_table_remove_all(s->share_keys);
 
+  g_free(s->sn);
+
   s->password_key = NULL;
   s->master_key = NULL;
   s->sid = NULL;
@@ -2298,6 +2793,7 @@ void mega_session_close(mega_session* s)
   s->user_name = NULL;
   s->fs_nodes = NULL;
   s->last_refresh = 0;
+  s->sn = NULL;
 
   s->status_callback = NULL;
 }
@@ -2383,6 +2879,283 @@ gboolean mega_session_get_user(mega_session* s, GError** err)
 // }}}
 // {{{ mega_session_refresh
 
+// parallel node parsing: nodes are independent once the share keys are
+// registered, so key and attribute decryption is spread over all cores
+
+struct _parse_nodes_data
+{
+  mega_session* s;
+  gchar** nodes;
+  mega_node** parsed;
+  gint count;
+  gint next;
+};
+
+static gpointer parse_nodes_worker(struct _parse_nodes_data* data)
+{
+  gint idx;
+
+  while ((idx = g_atomic_int_add(&data->next, 1)) < data->count)
+  {
+    const gchar* f = data->nodes[idx];
+
+    if (s_json_get_type(f) == S_JSON_TYPE_OBJECT)
+      data->parsed[idx] = mega_node_parse(data->s, f);
+  }
+
+  return NULL;
+}
+
+static void parse_nodes(mega_session* s, gchar** nodes, mega_node** parsed, gint count)
+{
+  struct _parse_nodes_data data = { s, nodes, parsed, count, 0 };
+#if GLIB_CHECK_VERSION(2, 36, 0)
+  gint n_threads = MIN(g_get_num_processors(), 16);
+#else
+  gint n_threads = 4;
+#endif
+
+  // not worth spawning threads for small responses
+  if (count < 512 || n_threads < 2)
+  {
+    parse_nodes_worker(&data);
+    return;
+  }
+
+  GThread** threads = g_new0(GThread*, n_threads);
+  gint i;
+
+  for (i = 0; i < n_threads; i++)
+    threads[i] = g_thread_new("mega parse", (GThreadFunc)parse_nodes_worker, &data);
+
+  for (i = 0; i < n_threads; i++)
+    g_thread_join(threads[i]);
+
+  g_free(threads);
+}
+
+static mega_node* session_find_node_by_handle(mega_session* s, const gchar* handle)
+{
+  GSList* i;
+
+  for (i = s->fs_nodes; i; i = i->next)
+  {
+    mega_node* n = i->data;
+
+    if (n->handle && !strcmp(n->handle, handle))
+      return n;
+  }
+
+  return NULL;
+}
+
+// insert a parsed node, replacing any existing node with the same handle
+static void session_insert_node(mega_session* s, mega_node* n)
+{
+  GSList* i;
+
+  for (i = s->fs_nodes; i; i = i->next)
+  {
+    mega_node* old = i->data;
+
+    if (old->handle && !strcmp(old->handle, n->handle))
+    {
+      i->data = n;
+      mega_node_free(old);
+      return;
+    }
+  }
+
+  s->fs_nodes = g_slist_append(s->fs_nodes, n);
+}
+
+// remove a node and all its descendants from the node list
+static void session_remove_subtree(mega_session* s, const gchar* handle)
+{
+  GSList* i;
+  GSList* victims = NULL;
+  gboolean progress = TRUE;
+  GHashTable* removed = g_hash_table_new(g_str_hash, g_str_equal);
+
+  g_hash_table_add(removed, (gpointer)handle);
+
+  // mark descendants until the set stops growing
+  while (progress)
+  {
+    progress = FALSE;
+
+    for (i = s->fs_nodes; i; i = i->next)
+    {
+      mega_node* n = i->data;
+
+      if (n->handle && !g_hash_table_contains(removed, n->handle) && n->parent_handle && g_hash_table_contains(removed, n->parent_handle))
+      {
+        g_hash_table_add(removed, n->handle);
+        progress = TRUE;
+      }
+    }
+  }
+
+  for (i = s->fs_nodes; i; i = i->next)
+  {
+    mega_node* n = i->data;
+
+    if (n->handle && g_hash_table_contains(removed, n->handle))
+      victims = g_slist_prepend(victims, n);
+  }
+
+  g_hash_table_destroy(removed);
+
+  for (i = victims; i; i = i->next)
+  {
+    s->fs_nodes = g_slist_remove(s->fs_nodes, i->data);
+    mega_node_free(i->data);
+  }
+
+  g_slist_free(victims);
+}
+
+// Incremental refresh: fetch the action packets accumulated on the
+// server-client (sc) channel since the last seen sequence number and
+// apply them to the existing node list. Returns FALSE when the delta
+// can't be applied (invalidated sequence, share/contact changes, unknown
+// packets referencing missing nodes, ...) and a full fetch is needed.
+static gboolean session_refresh_delta(mega_session* s)
+{
+  gc_error_free GError* local_err = NULL;
+  gboolean dirty = FALSE;
+
+  while (TRUE)
+  {
+    gc_free gchar* url = g_strdup_printf("https://%s/sc?sn=%s&%s=%s", api_endpoint_get(), s->sn, s->sid_param_name ? s->sid_param_name : "sid", s->sid);
+    gc_string_free GString* res = http_post(s->http, url, "", 0, &local_err);
+
+    if (!res || !s_json_is_valid(res->str))
+      return FALSE;
+
+    gc_free gchar* response = s_json_get(res->str);
+
+    if (mega_debug & MEGA_DEBUG_API)
+      print_node(response, "SC: ");
+
+    // a number response means the sequence was invalidated (or an error)
+    if (s_json_get_type(response) != S_JSON_TYPE_OBJECT)
+      return FALSE;
+
+    gc_free gchar* next_sn = s_json_get_member_string(response, "sn");
+    const gchar* a_node = s_json_get_member(response, "a");
+
+    if (a_node && s_json_get_type(a_node) == S_JSON_TYPE_ARRAY)
+    {
+      S_JSON_FOREACH_ELEMENT(a_node, pkt)
+        if (s_json_get_type(pkt) != S_JSON_TYPE_OBJECT)
+          continue;
+
+        gc_free gchar* action = s_json_get_member_string(pkt, "a");
+        if (!action)
+          continue;
+
+        if (!strcmp(action, "t"))
+        {
+          // new or moved-in nodes
+          const gchar* t_node = s_json_get_member(pkt, "t");
+          const gchar* f_node = t_node ? s_json_get_member(t_node, "f") : NULL;
+
+          if (f_node && s_json_get_type(f_node) == S_JSON_TYPE_ARRAY)
+          {
+            S_JSON_FOREACH_ELEMENT(f_node, f)
+              if (s_json_get_type(f) != S_JSON_TYPE_OBJECT)
+                continue;
+
+              mega_node* n = mega_node_parse(s, f);
+              if (!n)
+                return FALSE;
+
+              session_insert_node(s, n);
+              dirty = TRUE;
+            S_JSON_FOREACH_END()
+          }
+        }
+        else if (!strcmp(action, "d"))
+        {
+          gc_free gchar* handle = s_json_get_member_string(pkt, "n");
+
+          if (handle)
+          {
+            session_remove_subtree(s, handle);
+            dirty = TRUE;
+          }
+        }
+        else if (!strcmp(action, "u"))
+        {
+          // attribute or parent update of an existing node
+          gc_free gchar* handle = s_json_get_member_string(pkt, "n");
+          gc_free gchar* new_parent = s_json_get_member_string(pkt, "p");
+          gc_free gchar* new_attrs = s_json_get_member_string(pkt, "at");
+
+          mega_node* n = handle ? session_find_node_by_handle(s, handle) : NULL;
+          if (!n)
+            return FALSE;
+
+          if (new_parent)
+          {
+            g_free(n->parent_handle);
+            n->parent_handle = new_parent;
+            new_parent = NULL;
+          }
+
+          if (new_attrs)
+          {
+            guchar aes_key[16];
+            gchar* node_name = NULL;
+
+            if (n->type == MEGA_NODE_FILE)
+              unpack_node_key(n->key, aes_key, NULL, NULL);
+            else
+              memcpy(aes_key, n->key, 16);
+
+            if (!decrypt_node_attrs(new_attrs, aes_key, &node_name) || !node_name)
+            {
+              g_free(node_name);
+              return FALSE;
+            }
+
+            g_free(n->name);
+            n->name = node_name;
+          }
+
+          dirty = TRUE;
+        }
+        else if (!strcmp(action, "s") || !strcmp(action, "s2") || !strcmp(action, "c") || !strcmp(action, "ok"))
+        {
+          // share and contact changes affect keys and node visibility,
+          // resync to be safe
+          return FALSE;
+        }
+        // other packets don't affect the node list
+      S_JSON_FOREACH_END()
+    }
+
+    // follow the sequence until we are caught up
+    if (next_sn && strcmp(next_sn, s->sn) != 0)
+    {
+      g_free(s->sn);
+      s->sn = next_sn;
+      next_sn = NULL;
+      continue;
+    }
+
+    break;
+  }
+
+  if (dirty)
+    update_pathmap(s);
+
+  s->last_refresh = time(NULL);
+
+  return TRUE;
+}
+
 gboolean mega_session_refresh(mega_session* s, GError** err)
 {
   GError* local_err = NULL;
@@ -2392,6 +3165,10 @@ gboolean mega_session_refresh(mega_session* s, GError** err)
   g_return_val_if_fail(s != NULL, FALSE);
   g_return_val_if_fail(err == NULL || *err == NULL, FALSE);
 
+  // try applying action packets on top of the existing node list first
+  if (s->sn && s->sid && s->fs_nodes && session_refresh_delta(s))
+    return TRUE;
+
   // prepare request
   gc_free gchar* f_node = api_call(s, 'o', NULL, &local_err, "[{a:f, c:1}]");
   if (!f_node)
@@ -2403,6 +3180,10 @@ gboolean mega_session_refresh(mega_session* s, GError** err)
   if (mega_debug & MEGA_DEBUG_FS)
     print_node(f_node, "FS: ");
 
+  // remember the sequence number for later delta refreshes
+  g_free(s->sn);
+  s->sn = s_json_get_member_string(f_node, "sn");
+
   // process 'ok' array
   const gchar* ok_node = s_json_get_member(f_node, "ok");
   if (ok_node && s_json_get_type(ok_node) == S_JSON_TYPE_ARRAY)
@@ -2448,16 +3229,20 @@ gboolean mega_session_refresh(mega_session* s, GError** err)
   }
 
   gc_free gchar** ff_arr = s_json_get_elements(ff_node);
-  for (i = 0, l = g_strv_length(ff_arr); i < l; i++)
-  {
-    const gchar* f = ff_arr[i];
-    if (s_json_get_type(f) != S_JSON_TYPE_OBJECT)
-      continue;
+  l = g_strv_length(ff_arr);
 
-    mega_node* n = mega_node_parse(s, f);
-    if (n)
-      list = g_slist_prepend(list, n);
-  }
+  // register all share keys up front, node key decryption only reads the
+  // share key table afterwards and can run on all cores
+  for (i = 0; i < l; i++)
+    if (s_json_get_type(ff_arr[i]) == S_JSON_TYPE_OBJECT)
+      mega_node_parse_share_key(s, ff_arr[i]);
+
+  gc_free mega_node** parsed = g_new0(mega_node*, l ? l : 1);
+  parse_nodes(s, ff_arr, parsed, l);
+
+  for (i = 0; i < l; i++)
+    if (parsed[i])
+      list = g_slist_prepend(list, parsed[i]);
 
   // import special root node for contacts
   mega_node* n = g_new0(mega_node, 1);
@@ -2656,6 +3441,148 @@ GSList* mega_session_ls(mega_session* s, const gchar* path, gboolean recursive)
   return data.list;
 }
 
+// }}}
+// {{{ mega_session_ls_foreach
+
+static gint compare_node_names(gconstpointer a, gconstpointer b)
+{
+  const mega_node *na = a, *nb = b;
+
+  return strcmp(na->name ? na->name : "", nb->name ? nb->name : "");
+}
+
+static gboolean ls_foreach_walk(mega_session* s, const gchar* handle, gboolean recursive, mega_node_cb cb, gpointer userdata)
+{
+  GSList *children, *sorted, *i;
+  gboolean cont = TRUE;
+
+  // only the current directory is copied for sorting, never the subtree
+  children = s->children_map ? g_hash_table_lookup(s->children_map, handle) : NULL;
+  sorted = g_slist_sort(g_slist_copy(children), compare_node_names);
+
+  for (i = sorted; cont && i; i = i->next)
+  {
+    mega_node* n = i->data;
+
+    if (!cb(n, userdata))
+      cont = FALSE;
+    else if (recursive && n->type != MEGA_NODE_FILE)
+      cont = ls_foreach_walk(s, n->handle, recursive, cb, userdata);
+  }
+
+  g_slist_free(sorted);
+  return cont;
+}
+
+gboolean mega_session_ls_foreach(mega_session* s, const gchar* path, gboolean recursive, mega_node_cb cb, gpointer userdata)
+{
+  GSList *roots = NULL, *i;
+  gboolean cont = TRUE;
+
+  g_return_val_if_fail(s != NULL, FALSE);
+  g_return_val_if_fail(path != NULL, FALSE);
+  g_return_val_if_fail(cb != NULL, FALSE);
+
+  gc_free gchar* tmp = path_simplify(path);
+
+  if (strcmp(tmp, "/"))
+  {
+    mega_node* n = mega_session_stat(s, tmp);
+    if (!n)
+      return TRUE;
+
+    return ls_foreach_walk(s, n->handle, recursive, cb, userdata);
+  }
+
+  // root level lists the parentless nodes (/Root, /Contacts, ...)
+  for (i = s->fs_nodes; i; i = i->next)
+  {
+    mega_node* n = i->data;
+
+    if (!n->parent)
+      roots = g_slist_prepend(roots, n);
+  }
+
+  roots = g_slist_sort(roots, compare_node_names);
+
+  for (i = roots; cont && i; i = i->next)
+  {
+    mega_node* n = i->data;
+
+    if (!cb(n, userdata))
+      cont = FALSE;
+    else if (recursive)
+      cont = ls_foreach_walk(s, n->handle, recursive, cb, userdata);
+  }
+
+  g_slist_free(roots);
+  return cont;
+}
+
+// }}}
+// {{{ mega_session_narrow
+
+static gboolean node_in_subtree(mega_node* n, mega_node* root)
+{
+  while (n)
+  {
+    if (n == root)
+      return TRUE;
+
+    n = n->parent;
+  }
+
+  return FALSE;
+}
+
+void mega_session_narrow(mega_session* s, const gchar* remote_path)
+{
+  GSList *i, *next;
+  mega_node* p;
+
+  g_return_if_fail(s != NULL);
+  g_return_if_fail(remote_path != NULL);
+
+  mega_node* root = mega_session_stat(s, remote_path);
+  if (!root)
+    return;
+
+  // mark: ancestors are kept so the path to the target stays resolvable,
+  // and the whole keep set is collected up front because the sweep below
+  // must not walk parent pointers of nodes it already freed
+  GHashTable* keep_set = g_hash_table_new(g_direct_hash, g_direct_equal);
+  for (p = root->parent; p; p = p->parent)
+    g_hash_table_add(keep_set, p);
+
+  for (i = s->fs_nodes; i; i = i->next)
+  {
+    mega_node* n = i->data;
+
+    if (node_in_subtree(n, root))
+      g_hash_table_add(keep_set, n);
+  }
+
+  // sweep
+  for (i = s->fs_nodes; i; i = next)
+  {
+    mega_node* n = i->data;
+    next = i->next;
+
+    if (g_hash_table_contains(keep_set, n))
+      continue;
+
+    s->fs_nodes = g_slist_delete_link(s->fs_nodes, i);
+    mega_node_free(n);
+  }
+
+  g_hash_table_unref(keep_set);
+
+  // the partial tree must never overwrite the full session cache
+  s->narrowed = TRUE;
+
+  update_pathmap(s);
+}
+
 // }}}
 // {{{ mega_session_stat
 
@@ -2666,6 +3593,15 @@ mega_node* mega_session_stat(mega_session* s, const gchar* path)
 
   gc_free gchar* tmp = path_simplify(path);
 
+  if (s->path_map)
+  {
+    g_mutex_lock(&s->lock);
+    mega_node* n = g_hash_table_lookup(s->path_map, tmp);
+    g_mutex_unlock(&s->lock);
+
+    return n;
+  }
+
   GSList* iter;
   gchar n_path[4096];
   for (iter = s->fs_nodes; iter; iter = iter->next)
@@ -2693,6 +3629,15 @@ GSList* mega_session_get_node_chilren(mega_session* s, mega_node* node)
   g_return_val_if_fail(node != NULL, NULL);
   g_return_val_if_fail(node->handle != NULL, NULL);
 
+  if (s->children_map)
+  {
+    g_mutex_lock(&s->lock);
+    GSList* copy = g_slist_copy(g_hash_table_lookup(s->children_map, node->handle));
+    g_mutex_unlock(&s->lock);
+
+    return copy;
+  }
+
   for (i = s->fs_nodes; i; i = i->next)
   {
     mega_node* child = i->data;
@@ -2809,13 +3754,200 @@ mega_node* mega_session_mkdir(mega_session* s, const gchar* path, GError** err)
 }
 
 // }}}
-// {{{ mega_session_rm
+// {{{ mega_session_mkdir_bulk
 
-gboolean mega_session_rm(mega_session* s, const gchar* path, GError** err)
+// how many node inserts go into a single a:p request
+#define MKDIR_BULK_BATCH 512
+
+static gint path_depth(const gchar* path)
 {
-  GError* local_err = NULL;
+  gint depth = 0;
 
-  g_return_val_if_fail(s != NULL, FALSE);
+  for (; *path; path++)
+    if (*path == '/')
+      depth++;
+
+  return depth;
+}
+
+static gint compare_path_depth(const gchar* p1, const gchar* p2)
+{
+  return path_depth(p1) - path_depth(p2);
+}
+
+// create many directories at once; paths are grouped by level and parent so
+// that each a:p request carries a whole batch of node inserts instead of one,
+// which turns tree creation from one round-trip per directory into one per
+// (level, parent) batch; existing folders in the list are skipped, parents
+// must exist already or come earlier in the list
+gboolean mega_session_mkdir_bulk(mega_session* s, GSList* paths, GError** err)
+{
+  GError* local_err = NULL;
+  gc_ptr_array_unref GPtrArray* simplified = NULL;
+  GSList *i, *pending = NULL;
+  guint idx;
+
+  g_return_val_if_fail(s != NULL, FALSE);
+  g_return_val_if_fail(err == NULL || *err == NULL, FALSE);
+
+  if (g_slist_length(paths) == 0)
+    return TRUE;
+
+  // order paths by depth so that parents are created before their children
+  simplified = g_ptr_array_new_with_free_func(g_free);
+  for (i = paths; i; i = i->next)
+    g_ptr_array_add(simplified, path_simplify(i->data));
+
+  for (idx = 0; idx < simplified->len; idx++)
+    pending = g_slist_prepend(pending, g_ptr_array_index(simplified, idx));
+  pending = g_slist_sort(pending, (GCompareFunc)compare_path_depth);
+
+  while (pending)
+  {
+    gint level = path_depth(pending->data);
+    GHashTable* groups = g_hash_table_new(g_direct_hash, g_direct_equal);
+    GHashTableIter iter;
+    gpointer key, value;
+
+    // pick the paths of the current level and group them by parent node
+    while (pending && path_depth(pending->data) == level)
+    {
+      gchar* path = pending->data;
+      pending = g_slist_delete_link(pending, pending);
+
+      mega_node* d = mega_session_stat(s, path);
+      if (d)
+      {
+        if (mega_node_is_container(d))
+          continue;
+
+        g_set_error(err, MEGA_ERROR, MEGA_ERROR_OTHER, "File already exists at %s", path);
+        goto err0;
+      }
+
+      gc_free gchar* parent_path = g_path_get_dirname(path);
+      mega_node* p = mega_session_stat(s, parent_path);
+      if (!p || p->type == MEGA_NODE_FILE || p->type == MEGA_NODE_INBOX || p->type == MEGA_NODE_NETWORK)
+      {
+        g_set_error(err, MEGA_ERROR, MEGA_ERROR_OTHER, "Parent directory doesn't exist: %s", parent_path);
+        goto err0;
+      }
+
+      if (!mega_node_is_writable(s, p))
+      {
+        g_set_error(err, MEGA_ERROR, MEGA_ERROR_OTHER, "Parent directory is not writable: %s", parent_path);
+        goto err0;
+      }
+
+      g_hash_table_insert(groups, p, g_slist_prepend(g_hash_table_lookup(groups, p), path));
+    }
+
+    // one a:p call creates a whole batch of a parent's missing subdirectories
+    g_hash_table_iter_init(&iter, groups);
+    while (g_hash_table_iter_next(&iter, &key, &value))
+    {
+      mega_node* p = key;
+      GSList* rest = value;
+
+      while (rest)
+      {
+        gint count = 0;
+
+        SJsonGen* gen = s_json_gen_new();
+        s_json_gen_start_array(gen);
+        s_json_gen_start_object(gen);
+        s_json_gen_member_string(gen, "a", "p");
+        s_json_gen_member_string(gen, "t", p->handle);
+        s_json_gen_member_string(gen, "i", s->rid);
+        s_json_gen_member_array(gen, "n");
+
+        for (; rest && count < MKDIR_BULK_BATCH; rest = rest->next, count++)
+        {
+          gc_free guchar* node_key = make_random_key();
+          gc_free gchar* basename = g_path_get_basename(rest->data);
+          gc_free gchar* attrs = encode_node_attrs(basename);
+          gc_free gchar* dir_attrs = b64_aes128_cbc_encrypt_str(attrs, node_key);
+          gc_free gchar* dir_key = b64_aes128_encrypt(node_key, 16, s->master_key);
+
+          s_json_gen_start_object(gen);
+          s_json_gen_member_string(gen, "h", "xxxxxxxx");
+          s_json_gen_member_int(gen, "t", 1);
+          s_json_gen_member_string(gen, "k", dir_key);
+          s_json_gen_member_string(gen, "a", dir_attrs);
+          s_json_gen_end_object(gen);
+        }
+
+        s_json_gen_end_array(gen);
+        s_json_gen_end_object(gen);
+        s_json_gen_end_array(gen);
+        gc_free gchar* request = s_json_gen_done(gen);
+
+        // perform request
+        gc_free gchar* response = api_request(s, request, &local_err);
+        const gchar* mkdir_node = api_response_check(response, 'o', NULL, &local_err);
+        if (!mkdir_node)
+        {
+          g_propagate_prefixed_error(err, local_err, "API call 'p' failed: ");
+          goto err0;
+        }
+
+        const gchar* f_arr = s_json_get_member(mkdir_node, "f");
+        if (s_json_get_type(f_arr) != S_JSON_TYPE_ARRAY)
+        {
+          g_set_error(err, MEGA_ERROR, MEGA_ERROR_OTHER, "Invalid response");
+          goto err0;
+        }
+
+        gc_free gchar** f_els = s_json_get_elements(f_arr);
+        gint j;
+        for (j = 0; f_els[j]; j++)
+        {
+          mega_node* n = mega_node_parse(s, f_els[j]);
+          if (!n)
+          {
+            g_set_error(err, MEGA_ERROR, MEGA_ERROR_OTHER, "Invalid response");
+            goto err0;
+          }
+
+          s->fs_nodes = g_slist_append(s->fs_nodes, n);
+        }
+      }
+    }
+
+    // make this level's directories visible before resolving the next
+    // level's parents
+    update_pathmap(s);
+
+    g_hash_table_iter_init(&iter, groups);
+    while (g_hash_table_iter_next(&iter, &key, &value))
+      g_slist_free(value);
+    g_hash_table_unref(groups);
+    continue;
+
+err0:
+    g_hash_table_iter_init(&iter, groups);
+    while (g_hash_table_iter_next(&iter, &key, &value))
+      g_slist_free(value);
+    g_hash_table_unref(groups);
+    g_slist_free(pending);
+
+    // nodes created before the failure are already on the server, keep
+    // them visible in the session
+    update_pathmap(s);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+// }}}
+// {{{ mega_session_rm
+
+gboolean mega_session_rm(mega_session* s, const gchar* path, GError** err)
+{
+  GError* local_err = NULL;
+
+  g_return_val_if_fail(s != NULL, FALSE);
   g_return_val_if_fail(path != NULL, FALSE);
   g_return_val_if_fail(err == NULL || *err == NULL, FALSE);
 
@@ -3046,40 +4178,36 @@ static gchar* create_preview(mega_session* s, const gchar* local_path, const guc
 }
 
 // }}}
-// {{{ mega_session_put
+// {{{ transfer helpers
 
 static gboolean progress_generic(goffset total, goffset now, mega_session* s)
 {
+  mega_status_data sd;
   const gint64 timenow = g_get_monotonic_time();
+
+  g_mutex_lock(&s->status_lock);
   if (s->last_progress && s->last_progress + PROGRESS_FREQUENCY > timenow)
+  {
+    g_mutex_unlock(&s->status_lock);
     return TRUE;
+  }
 
-  init_status(s, MEGA_STATUS_PROGRESS);
-  s->status_data.progress.total = total;
-  s->status_data.progress.done = now;
-  s->status_data.progress.last = s->last_progress_bytes;
-  s->status_data.progress.span = timenow - s->last_progress;
+  init_status(&sd, MEGA_STATUS_PROGRESS);
+  sd.progress.total = total;
+  sd.progress.done = now;
+  sd.progress.last = s->last_progress_bytes;
+  sd.progress.span = timenow - s->last_progress;
 
   s->last_progress = timenow;
   s->last_progress_bytes = now;
+  g_mutex_unlock(&s->status_lock);
 
-  if (send_status(s))
+  if (send_status(s, &sd))
       return FALSE;
 
   return TRUE;
 }
 
-struct _put_data
-{
-  GFileInputStream* stream;
-  AES_KEY k;
-  guchar iv[AES_BLOCK_SIZE];
-  gint num;
-  guchar ecount[AES_BLOCK_SIZE];
-  chunked_cbc_mac mac;
-  GByteArray* buffer;
-};
-
 #if OPENSSL_VERSION_NUMBER >= 0x10100000L
 void AES_ctr128_encrypt(
   const unsigned char *in, 
@@ -3094,27 +4222,987 @@ void AES_ctr128_encrypt(
 }
 #endif
 
-static gsize put_process_data(gpointer buffer, gsize size, struct _put_data* data)
+// Double buffered pipeline for the single connection transfer paths:
+// crypto and disk I/O run on a worker thread while curl fills (or drains)
+// the other buffer, so the TCP stream doesn't stall on AES or writes.
+// Buffers are recycled between a free and a work queue; pipeline_eof is
+// pushed as a sentinel to shut the other side down.
+
+#define PIPELINE_BUFFERS 2
+#define PIPELINE_BLOCK_SIZE (128 * 1024)
+
+static GByteArray pipeline_eof;
+
+static void pipeline_drain_queue(GAsyncQueue* q)
 {
-  gc_error_free GError* local_err = NULL;
-  gsize bytes_read = 0;
+  GByteArray* buf;
 
-  if (size > data->buffer->len)
-    g_byte_array_set_size(data->buffer, size);
+  while ((buf = g_async_queue_try_pop(q)))
+  {
+    if (buf != &pipeline_eof)
+      g_byte_array_free(buf, TRUE);
+  }
+
+  g_async_queue_unref(q);
+}
+
+// }}}
+// {{{ multi-threaded AES-CTR
+
+// CTR mode counters are derived from the file position, so any block
+// aligned piece of a file can be encrypted or decrypted independently.
+// aes128_ctr_process_mt below exploits that twice: it goes through EVP so
+// that OpenSSL dispatches to hardware AES when the CPU has it, and when the
+// buffer is big enough it splits it into segments that are processed on
+// multiple threads, which lifts the single-core crypto ceiling on machines
+// without hardware AES.
+
+#define CTR_MT_SEGMENT_SIZE (1 * 1024 * 1024)
+#define CTR_MT_MAX_SEGMENTS 8
+
+// derive CTR mode iv (nonce + block counter) for a block aligned offset
+static void make_ctr_iv(guchar iv[16], guchar nonce[8], guint64 off)
+{
+  guint64 ctr = GUINT64_TO_BE(off / 16);
+
+  memcpy(iv, nonce, 8);
+  memcpy(iv + 8, &ctr, 8);
+}
+
+struct _ctr_mt_segment
+{
+  const guchar* key;
+  const guchar* nonce;
+  guint64 off;
+  guchar* data;
+  gsize size;
+};
+
+static gpointer ctr_mt_worker(struct _ctr_mt_segment* seg)
+{
+  guchar iv[16];
+  gint out_len = 0;
+
+  make_ctr_iv(iv, (guchar*)seg->nonce, seg->off);
+
+  EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+  EVP_EncryptInit_ex(ctx, EVP_aes_128_ctr(), NULL, seg->key, iv);
+  EVP_EncryptUpdate(ctx, seg->data, &out_len, seg->data, seg->size);
+  EVP_CIPHER_CTX_free(ctx);
+
+  return NULL;
+}
+
+// encrypt/decrypt a buffer located at a block aligned file offset in place
+static void aes128_ctr_process_mt(const guchar key[16], guchar nonce[8], guint64 off, guchar* data, gsize size)
+{
+  struct _ctr_mt_segment segs[CTR_MT_MAX_SEGMENTS];
+  GThread* threads[CTR_MT_MAX_SEGMENTS];
+  gsize i, n_segs, seg_size;
+
+  MEGA_PROFILE_BEGIN(span);
+
+  n_segs = (size + CTR_MT_SEGMENT_SIZE - 1) / CTR_MT_SEGMENT_SIZE;
+  n_segs = MIN(n_segs, CTR_MT_MAX_SEGMENTS);
+#if GLIB_CHECK_VERSION(2, 36, 0)
+  n_segs = MIN(n_segs, (gsize)g_get_num_processors());
+#endif
+
+  if (n_segs < 2)
+  {
+    struct _ctr_mt_segment seg = { key, nonce, off, data, size };
+
+    ctr_mt_worker(&seg);
+    MEGA_PROFILE_END(span, "crypto.ctr", size);
+    return;
+  }
+
+  // split into equal, block aligned segments; seg_size is rounded up, so
+  // the recomputed segment count can only shrink below the array sizes
+  seg_size = (((size + n_segs - 1) / n_segs) + 15) & ~(gsize)15;
+  n_segs = (size + seg_size - 1) / seg_size;
+
+  for (i = 0; i < n_segs; i++)
+  {
+    gsize start = i * seg_size;
+
+    segs[i].key = key;
+    segs[i].nonce = nonce;
+    segs[i].off = off + start;
+    segs[i].data = data + start;
+    segs[i].size = MIN(seg_size, size - start);
+
+    threads[i] = g_thread_new("mega ctr", (GThreadFunc)ctr_mt_worker, &segs[i]);
+  }
+
+  for (i = 0; i < n_segs; i++)
+    g_thread_join(threads[i]);
+
+  MEGA_PROFILE_END(span, "crypto.ctr", size);
+}
+
+// }}}
+// {{{ parallel download
+
+// Parallel download engine: the file is split into spans of whole chunks
+// (see get_chunk_size) and N worker threads fetch the spans concurrently
+// over separate connections using MEGA's <url>/<start>-<end> byte range
+// support. AES-CTR is seekable, so each worker decrypts its span in place
+// and computes per-chunk CBC-MACs independently; the consumer thread then
+// folds the chunk MACs into the meta-MAC and writes spans out in file
+// order. A bounded window of spans is kept in flight, so memory use stays
+// at O(workers * DOWNLOAD_SPAN_SIZE).
+
+#define DOWNLOAD_SPAN_SIZE (8 * 1024 * 1024)
+
+struct _get_span
+{
+  guint64 off;
+  guint64 size;
+  gsize first_chunk;
+  gsize n_chunks;
+
+  guchar* data;
+  guchar* macs;
+  gsize received;
+  gboolean done;
+};
+
+struct _get_parallel_data
+{
+  mega_session* s;
+  const gchar* url;
+  AES_KEY k;
+  guchar key[16];
+  guchar nonce[8];
+
+  GMutex lock;
+  GCond cond;
+
+  struct _get_span* spans;
+  gsize n_spans;
+  gsize next_span;
+  gsize write_span;
+  gsize max_in_flight;
+  gboolean failed;
+  GError* error;
+};
+
+// compute CBC-MAC of a single chunk of plaintext data (iv is nonce twice,
+// last block is zero padded)
+static void chunk_mac_compute(AES_KEY* k, guchar nonce[8], const guchar* data, gsize len, guchar mac_out[16])
+{
+  guchar mac[16], block[16];
+  gsize i, j;
+
+  memcpy(mac, nonce, 8);
+  memcpy(mac + 8, nonce, 8);
+
+  for (i = 0; i < len; i += 16)
+  {
+    gsize take = MIN(16, len - i);
+
+    memset(block, 0, 16);
+    memcpy(block, data + i, take);
+
+    for (j = 0; j < 16; j++)
+      mac[j] ^= block[j];
+
+    AES_encrypt(mac, mac, k);
+  }
+
+  memcpy(mac_out, mac, 16);
+}
+
+static gsize get_span_data(gpointer buffer, gsize size, struct _get_span* span)
+{
+  if (span->received + size > span->size)
+    return 0;
+
+  memcpy(span->data + span->received, buffer, size);
+  span->received += size;
+
+  return size;
+}
+
+static void get_parallel_fail(struct _get_parallel_data* ctx, GError* local_err)
+{
+  g_mutex_lock(&ctx->lock);
+
+  if (!ctx->failed)
+  {
+    ctx->failed = TRUE;
+    if (local_err)
+      ctx->error = g_error_copy(local_err);
+  }
+
+  g_cond_broadcast(&ctx->cond);
+  g_mutex_unlock(&ctx->lock);
+}
+
+static gpointer get_parallel_worker(struct _get_parallel_data* ctx)
+{
+  gc_http_free http* h = http_new();
+
+  http_set_speed(h, ctx->s->max_ul, ctx->s->max_dl);
+  http_set_proxy(h, ctx->s->proxy);
+
+  while (TRUE)
+  {
+    gc_error_free GError* local_err = NULL;
+    struct _get_span* span;
+    gsize i, idx;
+    guint64 coff;
+
+    // claim the next span, but don't run too far ahead of the writer
+    g_mutex_lock(&ctx->lock);
+
+    while (!ctx->failed && ctx->next_span < ctx->n_spans && ctx->next_span >= ctx->write_span + ctx->max_in_flight)
+      g_cond_wait(&ctx->cond, &ctx->lock);
+
+    if (ctx->failed || ctx->next_span >= ctx->n_spans)
+    {
+      g_mutex_unlock(&ctx->lock);
+      break;
+    }
+
+    idx = ctx->next_span++;
+    g_mutex_unlock(&ctx->lock);
+
+    span = ctx->spans + idx;
+    span->data = g_malloc(span->size);
+    span->macs = g_malloc(span->n_chunks * 16);
+    span->received = 0;
+
+    gc_free gchar* span_url = g_strdup_printf("%s/%" G_GUINT64_FORMAT "-%" G_GUINT64_FORMAT, ctx->url, span->off, span->off + span->size - 1);
+
+    if (!http_get_stream_download(h, span_url, (http_data_fn)get_span_data, span, span->size, 0, &local_err))
+    {
+      get_parallel_fail(ctx, local_err);
+      break;
+    }
+
+    if (span->received != span->size)
+    {
+      g_set_error(&local_err, MEGA_ERROR, MEGA_ERROR_OTHER, "Incomplete data for chunk at offset %" G_GUINT64_FORMAT, span->off);
+      get_parallel_fail(ctx, local_err);
+      break;
+    }
+
+    // decrypt in place, deriving the CTR counter from the span offset
+    aes128_ctr_process_mt(ctx->key, ctx->nonce, span->off, span->data, span->size);
+
+    // compute per-chunk MACs (folded into the meta-MAC by the writer)
+    coff = 0;
+    for (i = 0; i < span->n_chunks; i++)
+    {
+      guint64 csize = MIN(get_chunk_size(span->first_chunk + i), span->size - coff);
+
+      chunk_mac_compute(&ctx->k, ctx->nonce, span->data + coff, csize, span->macs + i * 16);
+      coff += csize;
+    }
+
+    g_mutex_lock(&ctx->lock);
+    span->done = TRUE;
+    g_cond_broadcast(&ctx->cond);
+    g_mutex_unlock(&ctx->lock);
+  }
+
+  return NULL;
+}
+
+static gboolean download_data_parallel(mega_session* s, const gchar* url, guchar aes_key[16], guchar nonce[8], guint64 file_size, GFileOutputStream* stream, guchar meta_mac_xor_calc[8], GError** err)
+{
+  struct _get_parallel_data ctx;
+  GError* local_err = NULL;
+  GThread** threads;
+  guchar meta_mac[16] = {0}, tmp[16];
+  guint64 off = 0, done_bytes = 0;
+  gsize i, c, chunk_idx = 0, n_workers;
+  gboolean status = FALSE;
+
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.s = s;
+  ctx.url = url;
+  memcpy(ctx.key, aes_key, 16);
+  memcpy(ctx.nonce, nonce, 8);
+  AES_set_encrypt_key(aes_key, 128, &ctx.k);
+  g_mutex_init(&ctx.lock);
+  g_cond_init(&ctx.cond);
+
+  // split the file into spans of whole chunks
+  GArray* spans = g_array_new(FALSE, TRUE, sizeof(struct _get_span));
+  while (off < file_size)
+  {
+    struct _get_span span;
+
+    memset(&span, 0, sizeof(span));
+    span.off = off;
+    span.first_chunk = chunk_idx;
+
+    while (off < file_size && (span.n_chunks == 0 || span.size + get_chunk_size(chunk_idx) <= DOWNLOAD_SPAN_SIZE))
+    {
+      guint64 csize = MIN(get_chunk_size(chunk_idx), file_size - off);
+
+      span.size += csize;
+      span.n_chunks++;
+      off += csize;
+      chunk_idx++;
+    }
+
+    g_array_append_val(spans, span);
+  }
+
+  ctx.spans = (struct _get_span*)spans->data;
+  ctx.n_spans = spans->len;
+
+  n_workers = MIN((gsize)s->max_workers, ctx.n_spans);
+  ctx.max_in_flight = n_workers * 2;
+
+  threads = g_new0(GThread*, n_workers);
+  for (i = 0; i < n_workers; i++)
+    threads[i] = g_thread_new("mega download", (GThreadFunc)get_parallel_worker, &ctx);
+
+  // consume spans in file order
+  for (i = 0; i < ctx.n_spans; i++)
+  {
+    struct _get_span* span = ctx.spans + i;
+
+    g_mutex_lock(&ctx.lock);
+    while (!span->done && !ctx.failed)
+      g_cond_wait(&ctx.cond, &ctx.lock);
+
+    if (ctx.failed)
+    {
+      g_mutex_unlock(&ctx.lock);
+      break;
+    }
+
+    ctx.write_span = i + 1;
+    g_cond_broadcast(&ctx.cond);
+    g_mutex_unlock(&ctx.lock);
+
+    // fold per-chunk MACs into the meta-MAC
+    for (c = 0; c < span->n_chunks; c++)
+    {
+      gint j;
+
+      for (j = 0; j < 16; j++)
+        meta_mac[j] ^= span->macs[c * 16 + j];
+
+      AES_encrypt(meta_mac, tmp, &ctx.k);
+      memcpy(meta_mac, tmp, 16);
+    }
+
+    mega_status_data sd;
+    init_status(&sd, MEGA_STATUS_DATA);
+    sd.data.size = span->size;
+    sd.data.buf = span->data;
+    if (send_status(s, &sd))
+    {
+      g_set_error(&local_err, MEGA_ERROR, MEGA_ERROR_OTHER, "Operation cancelled from status callback");
+      get_parallel_fail(&ctx, local_err);
+      break;
+    }
+
+    MEGA_PROFILE_BEGIN(write_span_time);
+    if (stream && !g_output_stream_write_all(G_OUTPUT_STREAM(stream), span->data, span->size, NULL, NULL, &local_err))
+    {
+      get_parallel_fail(&ctx, local_err);
+      break;
+    }
+    MEGA_PROFILE_END(write_span_time, "io.write", span->size);
+
+    done_bytes += span->size;
+    progress_generic(file_size, done_bytes, s);
+
+    g_free(span->data);
+    span->data = NULL;
+    g_free(span->macs);
+    span->macs = NULL;
+  }
+
+  for (i = 0; i < n_workers; i++)
+    g_thread_join(threads[i]);
+
+  if (ctx.failed)
+  {
+    if (ctx.error)
+      g_propagate_error(err, ctx.error);
+    else if (local_err)
+      g_propagate_error(err, local_err);
+    else
+      g_set_error(err, MEGA_ERROR, MEGA_ERROR_OTHER, "Download failed");
+
+    if (ctx.error && local_err)
+      g_error_free(local_err);
+  }
+  else
+  {
+    gint j;
+
+    for (j = 0; j < 4; j++)
+      meta_mac_xor_calc[j] = meta_mac[j] ^ meta_mac[j + 4];
+    for (j = 0; j < 4; j++)
+      meta_mac_xor_calc[j + 4] = meta_mac[j + 8] ^ meta_mac[j + 12];
+
+    status = TRUE;
+  }
+
+  for (i = 0; i < ctx.n_spans; i++)
+  {
+    g_free(ctx.spans[i].data);
+    g_free(ctx.spans[i].macs);
+  }
+
+  g_free(threads);
+  g_array_free(spans, TRUE);
+  g_cond_clear(&ctx.cond);
+  g_mutex_clear(&ctx.lock);
+
+  return status;
+}
+
+// }}}
+// {{{ parallel upload
+
+// Parallel upload engine: the counterpart of the parallel download above.
+// MEGA's upload URLs accept per-chunk posts at <url>/<offset>, so the
+// file is split into spans of whole chunks and N workers read, encrypt
+// (seeking the CTR counter to the span offset) and post the spans
+// concurrently, each over its own connection. Per-chunk CBC-MACs are
+// computed on the plaintext and folded into the meta-MAC in file order by
+// the coordinator. The server returns the completion handle in the
+// response to the post that completes the file.
+
+#define UPLOAD_SPAN_SIZE (8 * 1024 * 1024)
+
+// Uploads over this size checkpoint their progress into a state file in
+// the temp directory, so an interrupted upload continues from the last
+// completed span instead of starting over. The state carries the upload
+// URL, the file keys and the chunk MACs of the completed span prefix.
+#define PUT_RESUME_THRESHOLD (16 * 1024 * 1024)
+
+struct _put_resume_state
+{
+  const gchar* state_path;
+  gint64 mtime;
+  const guchar* aes_key;
+  const guchar* nonce;
+  const gchar* handle;
+  GPtrArray* span_macs; // b64 chunk MACs of completed spans, in file order
+};
+
+static void put_state_save(struct _put_resume_state* resume, const gchar* url, guint64 file_size, const gchar* handle)
+{
+  gsize i;
+
+  SJsonGen* gen = s_json_gen_new();
+  s_json_gen_start_object(gen);
+  s_json_gen_member_int(gen, "version", 1);
+  s_json_gen_member_int(gen, "file_size", file_size);
+  s_json_gen_member_int(gen, "mtime", resume->mtime);
+  s_json_gen_member_string(gen, "url", url);
+  s_json_gen_member_bytes(gen, "aes_key", (guchar*)resume->aes_key, 16);
+  s_json_gen_member_bytes(gen, "nonce", (guchar*)resume->nonce, 8);
+  s_json_gen_member_string(gen, "handle", handle);
+  s_json_gen_member_array(gen, "spans");
+  for (i = 0; i < resume->span_macs->len; i++)
+    s_json_gen_string(gen, g_ptr_array_index(resume->span_macs, i));
+  s_json_gen_end_array(gen);
+  s_json_gen_end_object(gen);
+
+  gc_free gchar* state = s_json_gen_done(gen);
+  // the state carries the plaintext file key, keep it out of other users'
+  // reach like the session cache
+  if (g_file_set_contents(resume->state_path, state, -1, NULL))
+    g_chmod(resume->state_path, 0600);
+}
+
+static gboolean put_state_load(const gchar* path, guint64 file_size, gint64 mtime, gchar** url, guchar* aes_key, guchar* nonce, gchar** handle, GPtrArray* span_macs)
+{
+  gc_free gchar* content = NULL;
+  gsize len = 0;
+
+  if (!g_file_get_contents(path, &content, NULL, NULL))
+    return FALSE;
+
+  if (!s_json_is_valid(content))
+    return FALSE;
+
+  gc_free gchar* obj = s_json_get(content);
+  if (s_json_get_type(obj) != S_JSON_TYPE_OBJECT)
+    return FALSE;
+
+  // the state is only good for an unchanged file
+  if (s_json_get_member_int(obj, "version", 0) != 1)
+    return FALSE;
+  if ((guint64)s_json_get_member_int(obj, "file_size", 0) != file_size)
+    return FALSE;
+  if (s_json_get_member_int(obj, "mtime", 0) != mtime)
+    return FALSE;
+
+  gc_free gchar* state_url = s_json_get_member_string(obj, "url");
+  gc_free guchar* state_key = s_json_get_member_bytes(obj, "aes_key", &len);
+  if (!state_url || !state_key || len != 16)
+    return FALSE;
+
+  gc_free guchar* state_nonce = s_json_get_member_bytes(obj, "nonce", &len);
+  if (!state_nonce || len != 8)
+    return FALSE;
+
+  memcpy(aes_key, state_key, 16);
+  memcpy(nonce, state_nonce, 8);
+  *url = state_url;
+  state_url = NULL;
+  *handle = s_json_get_member_string(obj, "handle");
+
+  const gchar* spans = s_json_get_member(obj, "spans");
+  if (s_json_get_type(spans) == S_JSON_TYPE_ARRAY)
+  {
+    S_JSON_FOREACH_ELEMENT(spans, span)
+      if (s_json_get_type(span) != S_JSON_TYPE_STRING)
+        break;
+
+      g_ptr_array_add(span_macs, s_json_get_string(span));
+    S_JSON_FOREACH_END()
+  }
+
+  return TRUE;
+}
+
+struct _put_span
+{
+  guint64 off;
+  guint64 size;
+  gsize first_chunk;
+  gsize n_chunks;
+
+  guchar* macs;
+  gboolean done;
+};
+
+struct _put_parallel_data
+{
+  mega_session* s;
+  GFile* file;
+  const gchar* url;
+  AES_KEY k;
+  guchar key[16];
+  guchar nonce[8];
+
+  GMutex lock;
+  GCond cond;
+
+  struct _put_span* spans;
+  gsize n_spans;
+  gsize next_span;
+  gsize write_span;
+  gsize max_in_flight;
+  gboolean failed;
+  GError* error;
+  GString* handle;
+};
+
+static void put_parallel_fail(struct _put_parallel_data* ctx, GError* local_err)
+{
+  g_mutex_lock(&ctx->lock);
+
+  if (!ctx->failed)
+  {
+    ctx->failed = TRUE;
+    if (local_err)
+      ctx->error = g_error_copy(local_err);
+  }
+
+  g_cond_broadcast(&ctx->cond);
+  g_mutex_unlock(&ctx->lock);
+}
+
+static gpointer put_parallel_worker(struct _put_parallel_data* ctx)
+{
+  gc_error_free GError* open_err = NULL;
+  gc_object_unref GFileInputStream* stream = NULL;
+  gc_http_free http* h = http_new();
+
+  http_set_content_type(h, "application/octet-stream");
+  http_set_speed(h, ctx->s->max_ul, ctx->s->max_dl);
+  http_set_proxy(h, ctx->s->proxy);
+
+  stream = g_file_read(ctx->file, NULL, &open_err);
+  if (!stream)
+  {
+    put_parallel_fail(ctx, open_err);
+    return NULL;
+  }
+
+  while (TRUE)
+  {
+    gc_error_free GError* local_err = NULL;
+    struct _put_span* span;
+    gsize i, idx, bytes_read = 0;
+    guint64 coff;
+
+    // claim the next span, but don't run too far ahead of the coordinator
+    g_mutex_lock(&ctx->lock);
+
+    while (!ctx->failed && ctx->next_span < ctx->n_spans && ctx->next_span >= ctx->write_span + ctx->max_in_flight)
+      g_cond_wait(&ctx->cond, &ctx->lock);
+
+    if (ctx->failed || ctx->next_span >= ctx->n_spans)
+    {
+      g_mutex_unlock(&ctx->lock);
+      break;
+    }
+
+    idx = ctx->next_span++;
+    g_mutex_unlock(&ctx->lock);
+
+    span = ctx->spans + idx;
+    span->macs = g_malloc(span->n_chunks * 16);
+
+    gc_free guchar* buf = g_malloc(span->size);
+
+    if (!g_seekable_seek(G_SEEKABLE(stream), span->off, G_SEEK_SET, NULL, &local_err))
+    {
+      put_parallel_fail(ctx, local_err);
+      break;
+    }
+
+    if (!g_input_stream_read_all(G_INPUT_STREAM(stream), buf, span->size, &bytes_read, NULL, &local_err) || bytes_read != span->size)
+    {
+      if (!local_err)
+        g_set_error(&local_err, MEGA_ERROR, MEGA_ERROR_OTHER, "Short read at offset %" G_GUINT64_FORMAT, span->off);
+      put_parallel_fail(ctx, local_err);
+      break;
+    }
+
+    // compute per-chunk MACs on the plaintext
+    coff = 0;
+    for (i = 0; i < span->n_chunks; i++)
+    {
+      guint64 csize = MIN(get_chunk_size(span->first_chunk + i), span->size - coff);
+
+      chunk_mac_compute(&ctx->k, ctx->nonce, buf + coff, csize, span->macs + i * 16);
+      coff += csize;
+    }
+
+    // encrypt in place, deriving the CTR counter from the span offset
+    aes128_ctr_process_mt(ctx->key, ctx->nonce, span->off, buf, span->size);
+
+    gc_free gchar* span_url = g_strdup_printf("%s/%" G_GUINT64_FORMAT, ctx->url, span->off);
+
+    GString* response = http_post(h, span_url, buf, span->size, &local_err);
+    if (!response)
+    {
+      put_parallel_fail(ctx, local_err);
+      break;
+    }
+
+    g_mutex_lock(&ctx->lock);
+
+    // the post completing the file returns the upload handle
+    if (response->len > 0 && !ctx->handle)
+    {
+      ctx->handle = response;
+      response = NULL;
+    }
+
+    span->done = TRUE;
+    g_cond_broadcast(&ctx->cond);
+    g_mutex_unlock(&ctx->lock);
+
+    if (response)
+      g_string_free(response, TRUE);
+  }
+
+  return NULL;
+}
+
+static GString* upload_data_parallel(mega_session* s, GFile* file, const gchar* url, guchar aes_key[16], guchar nonce[8], guint64 file_size, guchar meta_mac_out[16], struct _put_resume_state* resume, GError** err)
+{
+  struct _put_parallel_data ctx;
+  GThread** threads;
+  guchar meta_mac[16] = {0}, tmp[16];
+  guint64 off = 0, done_bytes = 0;
+  gsize i, c, chunk_idx = 0, n_workers, prefix_done = 0;
+  GString* handle = NULL;
+
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.s = s;
+  ctx.file = file;
+  ctx.url = url;
+  memcpy(ctx.key, aes_key, 16);
+  memcpy(ctx.nonce, nonce, 8);
+  AES_set_encrypt_key(aes_key, 128, &ctx.k);
+  g_mutex_init(&ctx.lock);
+  g_cond_init(&ctx.cond);
+
+  // split the file into spans of whole chunks
+  GArray* spans = g_array_new(FALSE, TRUE, sizeof(struct _put_span));
+  while (off < file_size)
+  {
+    struct _put_span span;
+
+    memset(&span, 0, sizeof(span));
+    span.off = off;
+    span.first_chunk = chunk_idx;
+
+    while (off < file_size && (span.n_chunks == 0 || span.size + get_chunk_size(chunk_idx) <= UPLOAD_SPAN_SIZE))
+    {
+      guint64 csize = MIN(get_chunk_size(chunk_idx), file_size - off);
+
+      span.size += csize;
+      span.n_chunks++;
+      off += csize;
+      chunk_idx++;
+    }
+
+    g_array_append_val(spans, span);
+  }
+
+  ctx.spans = (struct _put_span*)spans->data;
+  ctx.n_spans = spans->len;
+
+  if (resume)
+  {
+    // pre-mark the contiguous prefix of spans completed by a previous run;
+    // without a saved upload handle the last span must be re-posted, so that
+    // the server returns the handle again
+    gsize max_prefix = resume->handle ? ctx.n_spans : (ctx.n_spans > 0 ? ctx.n_spans - 1 : 0);
+
+    while (prefix_done < max_prefix && prefix_done < resume->span_macs->len)
+    {
+      struct _put_span* span = ctx.spans + prefix_done;
+      gsize macs_len = 0;
+      guchar* macs = base64urldecode(g_ptr_array_index(resume->span_macs, prefix_done), &macs_len);
+
+      if (!macs || macs_len != span->n_chunks * 16)
+      {
+        g_free(macs);
+        break;
+      }
+
+      span->macs = macs;
+      span->done = TRUE;
+      prefix_done++;
+    }
+
+    g_ptr_array_set_size(resume->span_macs, prefix_done);
+    ctx.next_span = prefix_done;
+  }
+
+  n_workers = MIN((gsize)s->max_workers, ctx.n_spans);
+  ctx.max_in_flight = n_workers * 2;
+
+  threads = g_new0(GThread*, n_workers);
+  for (i = 0; i < n_workers; i++)
+    threads[i] = g_thread_new("mega upload", (GThreadFunc)put_parallel_worker, &ctx);
+
+  // fold per-chunk MACs in file order, track progress
+  for (i = 0; i < ctx.n_spans; i++)
+  {
+    struct _put_span* span = ctx.spans + i;
+
+    g_mutex_lock(&ctx.lock);
+    while (!span->done && !ctx.failed)
+      g_cond_wait(&ctx.cond, &ctx.lock);
+
+    if (ctx.failed)
+    {
+      g_mutex_unlock(&ctx.lock);
+      break;
+    }
+
+    ctx.write_span = i + 1;
+    g_cond_broadcast(&ctx.cond);
+    g_mutex_unlock(&ctx.lock);
+
+    for (c = 0; c < span->n_chunks; c++)
+    {
+      gint j;
+
+      for (j = 0; j < 16; j++)
+        meta_mac[j] ^= span->macs[c * 16 + j];
+
+      AES_encrypt(meta_mac, tmp, &ctx.k);
+      memcpy(meta_mac, tmp, 16);
+    }
+
+    done_bytes += span->size;
+    progress_generic(file_size, done_bytes, s);
+
+    // checkpoint the newly completed span
+    if (resume && i >= prefix_done)
+    {
+      g_ptr_array_add(resume->span_macs, base64urlencode(span->macs, span->n_chunks * 16));
+      put_state_save(resume, url, file_size, resume->handle);
+    }
+
+    g_free(span->macs);
+    span->macs = NULL;
+  }
+
+  for (i = 0; i < n_workers; i++)
+    g_thread_join(threads[i]);
+
+  if (ctx.failed)
+  {
+    if (ctx.error)
+      g_propagate_error(err, ctx.error);
+    else
+      g_set_error(err, MEGA_ERROR, MEGA_ERROR_OTHER, "Upload failed");
+
+    if (ctx.handle)
+      g_string_free(ctx.handle, TRUE);
+  }
+  else
+  {
+    // the handle-returning post may have happened in the interrupted run
+    if (!ctx.handle && resume && resume->handle)
+      ctx.handle = g_string_new(resume->handle);
+
+    if (!ctx.handle)
+    {
+      g_set_error(err, MEGA_ERROR, MEGA_ERROR_OTHER, "Server didn't return an upload handle");
+    }
+    else
+    {
+      memcpy(meta_mac_out, meta_mac, 16);
+      handle = ctx.handle;
+    }
+  }
+
+  for (i = 0; i < ctx.n_spans; i++)
+    g_free(ctx.spans[i].macs);
+
+  g_free(threads);
+  g_array_free(spans, TRUE);
+  g_cond_clear(&ctx.cond);
+  g_mutex_clear(&ctx.lock);
+
+  return handle;
+}
+
+// }}}
+// {{{ mega_session_put
+
+// runs create_preview on a worker thread so thumbnail generation and the
+// ufa attribute upload overlap with the file data upload; api_call is
+// serialized by the session lock and the attribute data goes over its own
+// connection, so the worker never touches the transfer state
+struct _preview_work
+{
+  mega_session* s;
+  const gchar* local_path;
+  const guchar* aes_key;
+};
+
+static gpointer preview_worker(struct _preview_work* w)
+{
+  return create_preview(w->s, w->local_path, w->aes_key, NULL);
+}
+
+struct _put_data
+{
+  GFileInputStream* stream;
+  AES_KEY k;
+  guchar iv[AES_BLOCK_SIZE];
+  gint num;
+  guchar ecount[AES_BLOCK_SIZE];
+  chunked_cbc_mac mac;
+  GByteArray* buffer;
+
+  // pipelined mode
+  GAsyncQueue* work_queue;
+  GAsyncQueue* free_queue;
+  GByteArray* cur;
+  gsize cur_off;
+  gint failed;
+  gboolean eof;
+};
+
+// read-ahead worker: reads, MACs and encrypts blocks off the curl thread
+static gpointer put_pipeline_worker(struct _put_data* data)
+{
+  while (TRUE)
+  {
+    gc_error_free GError* local_err = NULL;
+    gsize bytes_read = 0;
+    GByteArray* buf = g_async_queue_pop(data->free_queue);
+
+    if (buf == &pipeline_eof)
+      break;
+
+    g_byte_array_set_size(buf, PIPELINE_BLOCK_SIZE);
+
+    if (!g_input_stream_read_all(G_INPUT_STREAM(data->stream), buf->data, buf->len, &bytes_read, NULL, &local_err))
+    {
+      g_printerr("ERROR: Failed reading from stream: %s\n", local_err->message);
+      g_atomic_int_set(&data->failed, TRUE);
+      g_async_queue_push(data->work_queue, &pipeline_eof);
+      g_byte_array_free(buf, TRUE);
+      break;
+    }
+
+    if (bytes_read > 0)
+    {
+      // MAC the plaintext, then encrypt in place
+      chunked_cbc_mac_update(&data->mac, buf->data, bytes_read);
+      AES_ctr128_encrypt(buf->data, buf->data, bytes_read, &data->k, data->iv, data->ecount, &data->num);
+      g_byte_array_set_size(buf, bytes_read);
+      g_async_queue_push(data->work_queue, buf);
+    }
+    else
+      g_byte_array_free(buf, TRUE);
+
+    if (bytes_read < PIPELINE_BLOCK_SIZE)
+    {
+      g_async_queue_push(data->work_queue, &pipeline_eof);
+      break;
+    }
+  }
+
+  return NULL;
+}
+
+static gsize put_process_data_async(gpointer buffer, gsize size, struct _put_data* data)
+{
+  gsize filled = 0;
+
+  while (filled < size)
+  {
+    if (!data->cur)
+    {
+      GByteArray* buf;
+
+      if (data->eof)
+        break;
+
+      buf = g_async_queue_pop(data->work_queue);
+      if (buf == &pipeline_eof)
+      {
+        data->eof = TRUE;
+        break;
+      }
+
+      data->cur = buf;
+      data->cur_off = 0;
+    }
 
-  if (!g_input_stream_read_all(G_INPUT_STREAM(data->stream), data->buffer->data, size, &bytes_read, NULL, &local_err))
-  {
-    g_printerr("ERROR: Failed reading from stream: %s\n", local_err->message);
-    return 0;
-  }
+    gsize take = MIN(size - filled, data->cur->len - data->cur_off);
+    memcpy((guchar*)buffer + filled, data->cur->data + data->cur_off, take);
+    data->cur_off += take;
+    filled += take;
 
-  if (bytes_read > 0)
-  {
-    AES_ctr128_encrypt(data->buffer->data, buffer, bytes_read, &data->k, data->iv, data->ecount, &data->num);
-    chunked_cbc_mac_update(&data->mac, data->buffer->data, bytes_read);
+    if (data->cur_off == data->cur->len)
+    {
+      g_async_queue_push(data->free_queue, data->cur);
+      data->cur = NULL;
+    }
   }
 
-  return bytes_read;
+  return filled;
 }
 
 mega_node* mega_session_put(mega_session* s, const gchar* remote_path, const gchar* local_path, GError** err)
@@ -3203,7 +5291,7 @@ mega_node* mega_session_put(mega_session* s, const gchar* remote_path, const gch
     return NULL;
   }   
 
-  gc_object_unref GFileInfo* info = g_file_input_stream_query_info(stream, G_FILE_ATTRIBUTE_STANDARD_SIZE, NULL, &local_err);
+  gc_object_unref GFileInfo* info = g_file_input_stream_query_info(stream, G_FILE_ATTRIBUTE_STANDARD_SIZE "," G_FILE_ATTRIBUTE_TIME_MODIFIED, NULL, &local_err);
   if (!info)
   {
     g_propagate_prefixed_error(err, local_err, "Can't read local file %s: ", local_path);
@@ -3211,37 +5299,156 @@ mega_node* mega_session_put(mega_session* s, const gchar* remote_path, const gch
   }
 
   goffset file_size = g_file_info_get_size(info);
+  gint64 mtime = (gint64)g_file_info_get_attribute_uint64(info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
 
-  // ask for upload url - [{"a":"u","ssl":0,"ms":0,"s":<SIZE>,"r":0,"e":0}]
-  gc_free gchar* up_node = api_call(s, 'o', NULL, &local_err, "[{a:u, ssl:0, ms:0, s:%i, r:0, e:0}]", (gint64)file_size);
-  if (!up_node)
+  // for large files keep a resume state file around, so that an interrupted
+  // upload continues where it left off instead of starting over
+  struct _put_resume_state resume;
+  gc_free gchar* state_path = NULL;
+  gc_free gchar* resume_url = NULL;
+  gc_free gchar* resume_handle = NULL;
+  gc_ptr_array_unref GPtrArray* span_macs = NULL;
+  guchar resume_aes_key[16], resume_nonce[8];
+  gboolean resumed = FALSE;
+
+  memset(&resume, 0, sizeof(resume));
+  if (file_size >= PUT_RESUME_THRESHOLD)
   {
-    g_propagate_error(err, local_err);
-    return NULL;
+    gc_checksum_free GChecksum* sum = g_checksum_new(G_CHECKSUM_SHA1);
+    g_checksum_update(sum, (guchar*)local_path, strlen(local_path));
+    g_checksum_update(sum, (guchar*)"|", 1);
+    g_checksum_update(sum, (guchar*)remote_path, strlen(remote_path));
+    state_path = g_strdup_printf("%s/%s.megaput.state", g_get_tmp_dir(), g_checksum_get_string(sum));
+
+    span_macs = g_ptr_array_new_with_free_func(g_free);
+    resumed = put_state_load(state_path, file_size, mtime, &resume_url, resume_aes_key, resume_nonce, &resume_handle, span_macs);
+  }
+
+  // setup buffer
+  data.buffer = buffer = g_byte_array_new();
+
+  gc_free gchar* p_url = NULL;
+  gc_free guchar* aes_key = NULL;
+  gc_free guchar* nonce = NULL;
+  gc_string_free GString* up_handle = NULL;
+  gc_free gchar* fa = NULL;
+  GThread* preview_thread = NULL;
+  struct _preview_work preview_work = { s, local_path, NULL };
+  guchar meta_mac[16];
+  gboolean parallel = (s->max_workers > 1 || state_path != NULL) && file_size > 0;
+  gboolean restarted = FALSE;
+
+restart:
+  if (resumed)
+  {
+    // reuse the upload url from the interrupted run
+    p_url = resume_url;
+    resume_url = NULL;
   }
+  else
+  {
+    // ask for upload url - [{"a":"u","ssl":0,"ms":0,"s":<SIZE>,"r":0,"e":0}]
+    gc_free gchar* up_node = api_call(s, 'o', NULL, &local_err, "[{a:u, ssl:0, ms:0, s:%i, r:0, e:0}]", (gint64)file_size);
+    if (!up_node)
+    {
+      g_propagate_error(err, local_err);
+      return NULL;
+    }
 
-  gc_free gchar* p_url = s_json_get_member_string(up_node, "p");
+    p_url = s_json_get_member_string(up_node, "p");
+  }
 
-  // setup encryption
-  gc_free guchar* aes_key = make_random_key();
-  gc_free guchar* nonce = make_random_key();
+  // setup encryption (the keys must match the already uploaded chunks when
+  // resuming)
+  aes_key = resumed ? g_memdup(resume_aes_key, 16) : make_random_key();
+  nonce = resumed ? g_memdup(resume_nonce, 8) : make_random_key();
   AES_set_encrypt_key(aes_key, 128, &data.k);
   memcpy(data.iv, nonce, 8);
   chunked_cbc_mac_init8(&data.mac, aes_key, nonce);
 
-  // setup buffer
-  data.buffer = buffer = g_byte_array_new();
+  // kick off preview generation early so it overlaps with the upload
+  preview_work.aes_key = aes_key;
+  if (s->create_preview)
+    preview_thread = g_thread_new("mega preview", (GThreadFunc)preview_worker, &preview_work);
 
   // perform upload
-  gc_http_free http* h = http_new();
-  http_set_content_type(h, "application/octet-stream");
-  http_set_progress_callback(h, (http_progress_fn)progress_generic, s);
-  http_set_speed(h, s->max_ul, s->max_dl);
-  http_set_proxy(h, s->proxy);
-  gc_string_free GString* up_handle = http_post_stream_upload(h, p_url, file_size, (http_data_fn)put_process_data, &data, &local_err);
+  if (state_path)
+  {
+    resume.state_path = state_path;
+    resume.mtime = mtime;
+    resume.aes_key = aes_key;
+    resume.nonce = nonce;
+    resume.handle = resume_handle;
+    resume.span_macs = span_macs;
+  }
+
+  if (parallel)
+  {
+    // post chunk spans concurrently over multiple connections
+    up_handle = upload_data_parallel(s, file, p_url, aes_key, nonce, file_size, meta_mac, state_path ? &resume : NULL, &local_err);
+  }
+  else
+  {
+    // pipelined mode: a worker thread reads, MACs and encrypts ahead while
+    // curl posts the previous block
+    gsize pi;
+    data.work_queue = g_async_queue_new();
+    data.free_queue = g_async_queue_new();
+    for (pi = 0; pi < PIPELINE_BUFFERS; pi++)
+      g_async_queue_push(data.free_queue, g_byte_array_new());
+    GThread* pipeline = g_thread_new("mega put pipeline", (GThreadFunc)put_pipeline_worker, &data);
+
+    gc_http_free http* h = http_new();
+    http_set_content_type(h, "application/octet-stream");
+    http_set_progress_callback(h, (http_progress_fn)progress_generic, s);
+    http_set_speed(h, s->max_ul, s->max_dl);
+    http_set_proxy(h, s->proxy);
+    up_handle = http_post_stream_upload(h, p_url, file_size, (http_data_fn)put_process_data_async, &data, &local_err);
+
+    g_async_queue_push(data.free_queue, &pipeline_eof);
+    g_thread_join(pipeline);
+
+    if (data.cur)
+      g_byte_array_free(data.cur, TRUE);
+
+    pipeline_drain_queue(data.work_queue);
+    pipeline_drain_queue(data.free_queue);
+
+    if (up_handle && g_atomic_int_get(&data.failed))
+    {
+      g_string_free(up_handle, TRUE);
+      up_handle = NULL;
+      g_set_error(&local_err, MEGA_ERROR, MEGA_ERROR_OTHER, "Reading local file failed");
+    }
+  }
+
+  // collect the preview before any early return can free the key it uses
+  if (preview_thread)
+  {
+    fa = g_thread_join(preview_thread);
+    preview_thread = NULL;
+  }
 
   if (!up_handle)
   {
+    // the saved upload url may have lapsed since the interrupted run;
+    // discard the stale state and start over with a fresh url and keys
+    if (resumed && !restarted)
+    {
+      restarted = TRUE;
+      resumed = FALSE;
+
+      g_unlink(state_path);
+      g_ptr_array_set_size(span_macs, 0);
+      g_clear_pointer(&resume_handle, g_free);
+      g_clear_pointer(&p_url, g_free);
+      g_clear_pointer(&aes_key, g_free);
+      g_clear_pointer(&nonce, g_free);
+      g_clear_pointer(&fa, g_free);
+      g_clear_error(&local_err);
+      goto restart;
+    }
+
     g_propagate_prefixed_error(err, local_err, "Data upload failed: ");
     return NULL;
   }
@@ -3259,17 +5466,17 @@ mega_node* mega_session_put(mega_session* s, const gchar* remote_path, const gch
     return NULL;
   }
 
-  // create preview
-  gc_free gchar* fa = NULL;
-  if (s->create_preview)
-    fa = create_preview(s, local_path, aes_key, NULL);
+  // all data is up, remember the handle in case the node creation fails
+  if (state_path)
+    put_state_save(&resume, p_url, file_size, up_handle->str);
 
   gc_free gchar* attrs = encode_node_attrs(file_name);
   gc_free gchar* attrs_enc = b64_aes128_cbc_encrypt_str(attrs, aes_key);
-  guchar meta_mac[16];
   guchar node_key[32];
 
-  chunked_cbc_mac_finish(&data.mac, meta_mac);
+  if (!parallel)
+    chunked_cbc_mac_finish(&data.mac, meta_mac);
+
   pack_node_key(node_key, aes_key, nonce, meta_mac);
   gc_free gchar* node_key_enc = b64_aes128_encrypt(node_key, 32, s->master_key);
 
@@ -3303,12 +5510,80 @@ mega_node* mega_session_put(mega_session* s, const gchar* remote_path, const gch
   }
 
   // add uploaded node to the filesystem
+  g_mutex_lock(&s->lock);
   s->fs_nodes = g_slist_append(s->fs_nodes, nn);
   nn->parent = parent_node;
+  pathmap_insert_node(s, nn);
+  g_mutex_unlock(&s->lock);
+
+  if (state_path)
+    g_unlink(state_path);
 
   return nn;
 }
 
+// }}}
+// {{{ download output buffering
+
+// Curl hands out data in small blocks; writing them straight to the output
+// stream produces thousands of tiny unaligned writes and fragments the file
+// on extent based filesystems. Aggregate decrypted data into a large buffer
+// and write it out in WRITE_BUFFER_SIZE pieces instead.
+
+#define WRITE_BUFFER_SIZE (2 * 1024 * 1024)
+
+static gboolean write_buffer_flush(GFileOutputStream* stream, GByteArray* wb)
+{
+  gc_error_free GError* local_err = NULL;
+
+  if (!wb || wb->len == 0)
+    return TRUE;
+
+  MEGA_PROFILE_BEGIN(span);
+
+  if (!g_output_stream_write_all(G_OUTPUT_STREAM(stream), wb->data, wb->len, NULL, NULL, &local_err))
+  {
+    g_printerr("ERROR: Failed writing to stream: %s\n", local_err->message);
+    return FALSE;
+  }
+
+  MEGA_PROFILE_END(span, "io.write", wb->len);
+
+  g_byte_array_set_size(wb, 0);
+  return TRUE;
+}
+
+static gboolean write_buffer_append(GFileOutputStream* stream, GByteArray* wb, const guchar* data, gsize size)
+{
+  g_byte_array_append(wb, data, size);
+
+  if (wb->len >= WRITE_BUFFER_SIZE)
+    return write_buffer_flush(stream, wb);
+
+  return TRUE;
+}
+
+// Preallocate space for the file and declare the sequential write pattern to
+// the kernel. Everything here is best effort.
+static void stream_prepare_for_size(GFileOutputStream* stream, guint64 file_size)
+{
+#ifdef HAVE_GIO_UNIX
+  if (file_size == 0 || !G_IS_FILE_DESCRIPTOR_BASED(stream))
+    return;
+
+  gint fd = g_file_descriptor_based_get_fd(G_FILE_DESCRIPTOR_BASED(stream));
+
+#ifdef HAVE_FALLOCATE
+  // KEEP_SIZE, so that an aborted download doesn't look fully written to the
+  // partial file resume check
+  fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, file_size);
+#endif
+#ifdef HAVE_POSIX_FADVISE
+  posix_fadvise(fd, 0, file_size, POSIX_FADV_SEQUENTIAL);
+#endif
+#endif
+}
+
 // }}}
 // {{{ mega_session_get
 
@@ -3322,6 +5597,12 @@ struct _get_data
   guchar ecount[AES_BLOCK_SIZE];
   chunked_cbc_mac mac;
   GByteArray* buffer;
+  GByteArray* write_buffer;
+
+  // pipelined mode
+  GAsyncQueue* work_queue;
+  GAsyncQueue* free_queue;
+  gint failed;
 };
 
 static gsize get_process_data(gpointer buffer, gsize size, struct _get_data* data)
@@ -3335,15 +5616,19 @@ static gsize get_process_data(gpointer buffer, gsize size, struct _get_data* dat
 
   chunked_cbc_mac_update(&data->mac, data->buffer->data, size);
 
-  init_status(data->s, MEGA_STATUS_DATA);
-  data->s->status_data.data.size = size;
-  data->s->status_data.data.buf = data->buffer->data;
-  if (send_status(data->s)) 
+  mega_status_data sd;
+  init_status(&sd, MEGA_STATUS_DATA);
+  sd.data.size = size;
+  sd.data.buf = data->buffer->data;
+  if (send_status(data->s, &sd)) 
     return 0;
 
   if (!data->stream)
     return size;
 
+  if (data->write_buffer)
+    return write_buffer_append(data->stream, data->write_buffer, data->buffer->data, size) ? size : 0;
+
   if (!g_output_stream_write_all(G_OUTPUT_STREAM(data->stream), data->buffer->data, size, NULL, NULL, &local_err))
   {
     g_printerr("ERROR: Failed writing to stream: %s\n", local_err->message);
@@ -3353,6 +5638,40 @@ static gsize get_process_data(gpointer buffer, gsize size, struct _get_data* dat
   return size;
 }
 
+// pipeline worker: decrypts, MACs and writes blocks off the curl thread
+static gpointer get_pipeline_worker(struct _get_data* data)
+{
+  while (TRUE)
+  {
+    GByteArray* buf = g_async_queue_pop(data->work_queue);
+
+    if (buf == &pipeline_eof)
+      break;
+
+    if (!g_atomic_int_get(&data->failed) && get_process_data(buf->data, buf->len, data) != buf->len)
+      g_atomic_int_set(&data->failed, TRUE);
+
+    g_async_queue_push(data->free_queue, buf);
+  }
+
+  return NULL;
+}
+
+static gsize get_process_data_async(gpointer buffer, gsize size, struct _get_data* data)
+{
+  GByteArray* buf;
+
+  if (g_atomic_int_get(&data->failed))
+    return 0;
+
+  buf = g_async_queue_pop(data->free_queue);
+  g_byte_array_set_size(buf, size);
+  memcpy(buf->data, buffer, size);
+  g_async_queue_push(data->work_queue, buf);
+
+  return size;
+}
+
 // megaget; verifies partially downloaded file
 static gboolean partial_get_verify_data(GFile* file, gsize size, struct _get_data* data, GError** err)
 {
@@ -3425,6 +5744,7 @@ gboolean mega_session_get(mega_session* s, const gchar* local_path, const gchar*
   gc_free gchar* get_node = NULL, *url = NULL, *orig_fname = NULL;
   gc_http_free http* h = NULL;
   gc_byte_array_unref GByteArray* buffer = NULL;
+  gc_byte_array_unref GByteArray* write_buffer = NULL;
   gboolean partial_file = FALSE;
   goffset resume_from = 0;
 
@@ -3442,10 +5762,11 @@ gboolean mega_session_get(mega_session* s, const gchar* local_path, const gchar*
     return FALSE;
   }
 
-  init_status(s, MEGA_STATUS_FILEINFO);
-  s->status_data.fileinfo.name = n->name;
-  s->status_data.fileinfo.size = n->size;
-  if (send_status(s)) 
+  mega_status_data sd;
+  init_status(&sd, MEGA_STATUS_FILEINFO);
+  sd.fileinfo.name = n->name;
+  sd.fileinfo.size = n->size;
+  if (send_status(s, &sd))
   {
     g_set_error(err, MEGA_ERROR, MEGA_ERROR_OTHER, "Operation cancelled from status callback");
     return FALSE;
@@ -3488,114 +5809,295 @@ gboolean mega_session_get(mega_session* s, const gchar* local_path, const gchar*
       gc_free gchar* tmpfname = g_strdup_printf("%s%s", tmpbname, ".partial");
       orig_fname = g_strdup(tmpbname);
 
-      gc_object_unref GFile* parent = g_file_get_parent(file);
-      file = g_file_get_child(parent, tmpfname);
-    }
+      gc_object_unref GFile* parent = g_file_get_parent(file);
+      file = g_file_get_child(parent, tmpfname);
+    }
+
+    // check if file is partially downloaded
+    partial_file = get_partial_file_offset(file, &resume_from, err);
+    if (resume_from == -1)
+      goto err;
+
+    // append to partial file, otherwise create new file
+    if (partial_file)
+      data.stream = stream = g_file_append_to(file, 0, NULL, &local_err);
+    else
+      data.stream = stream = g_file_create(file, 0, NULL, &local_err);
+
+    if (!data.stream)
+    {
+      g_propagate_prefixed_error(err, local_err, "Can't open local file %s for writing: ", local_path);
+      return FALSE;
+    }
+  }
+
+  // initialize decrytpion key/state
+  guchar aes_key[16], meta_mac_xor[8];
+  unpack_node_key(n->key, aes_key, data.iv, meta_mac_xor);
+  AES_set_encrypt_key(aes_key, 128, &data.k);
+  chunked_cbc_mac_init8(&data.mac, aes_key, data.iv);
+
+  // prepare request
+  get_node = api_call(s, 'o', NULL, &local_err, "[{a:g, g:1, ssl:0, n:%s}]", n->handle);
+  if (!get_node)
+  {
+    g_propagate_error(err, local_err);
+    goto err;
+  }
+
+  gint64 file_size = s_json_get_member_int(get_node, "s", -1);
+  if (file_size < 0)
+  {
+    g_set_error(err, MEGA_ERROR, MEGA_ERROR_OTHER, "Can't determine file size");
+    goto err;
+  }
+
+  url = s_json_get_member_string(get_node, "g");
+  if (!url)
+  {
+    g_set_error(err, MEGA_ERROR, MEGA_ERROR_OTHER, "Can't determine download url");
+    goto err;
+  }
+
+  // sanity check partial download conditions
+  if (resume_from >= file_size)
+  {
+    gc_free gchar* path = g_file_get_path(file);
+    g_set_error(err, MEGA_ERROR, MEGA_ERROR_OTHER, "Potential overwrite of file with same name: '%s'", path);
+    goto err;
+  }
+
+  if (data.stream && !partial_file)
+    stream_prepare_for_size(data.stream, file_size);
+
+  // setup buffer
+  data.buffer = buffer = g_byte_array_new();
+
+  if (partial_file && !partial_get_verify_data(file, resume_from, &data, err))
+  {
+    g_propagate_prefixed_error(err, local_err, "Failed to verify partial file: ");
+    goto err;
+  }
+
+  // perform download
+  guchar meta_mac_xor_calc[8];
+  gboolean parallel = s->max_workers > 1 && resume_from == 0;
+
+  if (parallel)
+  {
+    // fetch chunk ranges concurrently over multiple connections
+    if (!download_data_parallel(s, url, aes_key, data.iv, file_size, data.stream, meta_mac_xor_calc, &local_err))
+    {
+      g_propagate_prefixed_error(err, local_err, "Data download failed: ");
+      goto err;
+    }
+  }
+  else
+  {
+    // pipelined mode: curl fills one buffer while a worker thread decrypts,
+    // MACs and writes the previous one
+    gsize pi;
+    if (data.stream)
+      data.write_buffer = write_buffer = g_byte_array_new();
+    data.work_queue = g_async_queue_new();
+    data.free_queue = g_async_queue_new();
+    for (pi = 0; pi < PIPELINE_BUFFERS; pi++)
+      g_async_queue_push(data.free_queue, g_byte_array_new());
+    GThread* pipeline = g_thread_new("mega get pipeline", (GThreadFunc)get_pipeline_worker, &data);
+
+    h = http_new();
+    http_set_progress_callback(h, (http_progress_fn)progress_generic, s);
+    http_set_speed(h, s->max_ul, s->max_dl);
+    http_set_proxy(h, s->proxy);
+    gboolean dl_ok = http_get_stream_download(h, url, (http_data_fn)get_process_data_async, &data, file_size, resume_from, &local_err);
+
+    g_async_queue_push(data.work_queue, &pipeline_eof);
+    g_thread_join(pipeline);
+
+    pipeline_drain_queue(data.work_queue);
+    pipeline_drain_queue(data.free_queue);
+
+    if (dl_ok && !g_atomic_int_get(&data.failed) && !write_buffer_flush(data.stream, data.write_buffer))
+      g_atomic_int_set(&data.failed, TRUE);
+
+    if (!dl_ok)
+    {
+      g_propagate_prefixed_error(err, local_err, "Data download failed: ");
+      goto err;
+    }
+
+    if (g_atomic_int_get(&data.failed))
+    {
+      g_set_error(err, MEGA_ERROR, MEGA_ERROR_OTHER, "Writing downloaded data failed");
+      goto err;
+    }
+  }
+
+  if (file)
+  {
+    if (!g_output_stream_close(G_OUTPUT_STREAM(data.stream), NULL, &local_err))
+    {
+      g_propagate_prefixed_error(err, local_err, "Can't close downloaded file: ");
+      goto err;
+    }
+  }
+
+  // check mac of the downloaded file
+  if (!parallel)
+    chunked_cbc_mac_finish8(&data.mac, meta_mac_xor_calc);
+  if (memcmp(meta_mac_xor, meta_mac_xor_calc, 8) != 0)
+  {
+    g_set_error(err, MEGA_ERROR, MEGA_ERROR_OTHER, "MAC mismatch");
+    goto err;
+  }
+
+  // rename downloaded file, e.g. remove ".partial"
+  file = g_file_set_display_name(file, orig_fname, NULL, &local_err);
+  if (!file)
+  {
+    g_propagate_prefixed_error(err, local_err, "Failed to rename file: ");
+    goto err;
+  }
+
+  return TRUE;
+
+err:
+  return FALSE;
+}
+
+// }}}
+// {{{ mega_session_get_range
+
+// AES-CTR can be decrypted from any offset, so a sub-range of a remote file
+// can be fetched without downloading the rest. Data is delivered through the
+// MEGA_STATUS_DATA status callback. The meta-MAC can't be verified for
+// partial data, so there is no integrity check here.
+
+struct _get_range_data
+{
+  mega_session* s;
+  AES_KEY k;
+  guchar iv[AES_BLOCK_SIZE];
+  gint num;
+  guchar ecount[AES_BLOCK_SIZE];
+  GByteArray* buffer;
+  gsize skip;
+};
+
+static gsize get_range_process_data(gpointer buffer, gsize size, struct _get_range_data* data)
+{
+  if (size > data->buffer->len)
+    g_byte_array_set_size(data->buffer, size);
+
+  AES_ctr128_encrypt(buffer, data->buffer->data, size, &data->k, data->iv, data->ecount, &data->num);
+
+  // drop decrypted bytes before the block-aligned range start
+  gsize skip = MIN(data->skip, size);
+  data->skip -= skip;
+
+  if (size > skip)
+  {
+    mega_status_data sd;
+    init_status(&sd, MEGA_STATUS_DATA);
+    sd.data.size = size - skip;
+    sd.data.buf = data->buffer->data + skip;
+    if (send_status(data->s, &sd))
+      return 0;
+  }
+
+  return size;
+}
+
+gboolean mega_session_get_range(mega_session* s, const gchar* remote_path, guint64 offset, guint64 length, GError** err)
+{
+  struct _get_range_data data;
+  GError* local_err = NULL;
+  gc_free gchar *get_node = NULL, *url = NULL;
+  gc_byte_array_unref GByteArray* buffer = NULL;
 
-    // check if file is partially downloaded
-    partial_file = get_partial_file_offset(file, &resume_from, err);
-    if (resume_from == -1)
-      goto err;
+  g_return_val_if_fail(s != NULL, FALSE);
+  g_return_val_if_fail(remote_path != NULL, FALSE);
+  g_return_val_if_fail(length > 0, FALSE);
+  g_return_val_if_fail(err == NULL || *err == NULL, FALSE);
 
-    // append to partial file, otherwise create new file
-    if (partial_file)
-      data.stream = stream = g_file_append_to(file, 0, NULL, &local_err);
-    else
-      data.stream = stream = g_file_create(file, 0, NULL, &local_err);
+  memset(&data, 0, sizeof(data));
+  data.s = s;
 
-    if (!data.stream)
-    {
-      g_propagate_prefixed_error(err, local_err, "Can't open local file %s for writing: ", local_path);
-      return FALSE;
-    }
+  mega_node* n = mega_session_stat(s, remote_path);
+  if (!n || n->type != MEGA_NODE_FILE)
+  {
+    g_set_error(err, MEGA_ERROR, MEGA_ERROR_OTHER, "Remote file not found: %s", remote_path);
+    return FALSE;
   }
 
-  // initialize decrytpion key/state
-  guchar aes_key[16], meta_mac_xor[8];
-  unpack_node_key(n->key, aes_key, data.iv, meta_mac_xor);
+  mega_status_data sd;
+  init_status(&sd, MEGA_STATUS_FILEINFO);
+  sd.fileinfo.name = n->name;
+  sd.fileinfo.size = n->size;
+  if (send_status(s, &sd))
+  {
+    g_set_error(err, MEGA_ERROR, MEGA_ERROR_OTHER, "Operation cancelled from status callback");
+    return FALSE;
+  }
+
+  // initialize decryption key
+  guchar aes_key[16], nonce[8], meta_mac_xor[8];
+  unpack_node_key(n->key, aes_key, nonce, meta_mac_xor);
   AES_set_encrypt_key(aes_key, 128, &data.k);
-  chunked_cbc_mac_init8(&data.mac, aes_key, data.iv);
 
   // prepare request
   get_node = api_call(s, 'o', NULL, &local_err, "[{a:g, g:1, ssl:0, n:%s}]", n->handle);
   if (!get_node)
   {
     g_propagate_error(err, local_err);
-    goto err;
+    return FALSE;
   }
 
   gint64 file_size = s_json_get_member_int(get_node, "s", -1);
   if (file_size < 0)
   {
     g_set_error(err, MEGA_ERROR, MEGA_ERROR_OTHER, "Can't determine file size");
-    goto err;
+    return FALSE;
+  }
+
+  if (offset >= (guint64)file_size)
+  {
+    g_set_error(err, MEGA_ERROR, MEGA_ERROR_OTHER, "Range offset is beyond the end of the file");
+    return FALSE;
   }
 
+  length = MIN(length, file_size - offset);
+
   url = s_json_get_member_string(get_node, "g");
   if (!url)
   {
     g_set_error(err, MEGA_ERROR, MEGA_ERROR_OTHER, "Can't determine download url");
-    goto err;
+    return FALSE;
   }
 
-  // sanity check partial download conditions
-  if (resume_from >= file_size)
-  {
-    gc_free gchar* path = g_file_get_path(file);
-    g_set_error(err, MEGA_ERROR, MEGA_ERROR_OTHER, "Potential overwrite of file with same name: '%s'", path);
-    goto err;
-  }
+  // align the range start down to the AES block size and derive the CTR
+  // counter for it, extra leading bytes are skipped before delivery
+  guint64 start = offset & ~(guint64)(AES_BLOCK_SIZE - 1);
+  guint64 end = offset + length - 1;
 
-  // setup buffer
+  data.skip = offset - start;
+  make_ctr_iv(data.iv, nonce, start);
   data.buffer = buffer = g_byte_array_new();
 
-  if (partial_file && !partial_get_verify_data(file, resume_from, &data, err))
-  {
-    g_propagate_prefixed_error(err, local_err, "Failed to verify partial file: ");
-    goto err;
-  }
+  gc_free gchar* range_url = g_strdup_printf("%s/%" G_GUINT64_FORMAT "-%" G_GUINT64_FORMAT, url, start, end);
 
-  // perform download
-  h = http_new();
+  gc_http_free http* h = http_new();
   http_set_progress_callback(h, (http_progress_fn)progress_generic, s);
   http_set_speed(h, s->max_ul, s->max_dl);
   http_set_proxy(h, s->proxy);
-  if (!http_get_stream_download(h, url, (http_data_fn)get_process_data, &data, file_size, resume_from, &local_err))
-  {
-    g_propagate_prefixed_error(err, local_err, "Data download failed: ");
-    goto err;
-  }
-
-  if (file)
-  {
-    if (!g_output_stream_close(G_OUTPUT_STREAM(data.stream), NULL, &local_err))
-    {
-      g_propagate_prefixed_error(err, local_err, "Can't close downloaded file: ");
-      goto err;
-    }
-  }
-
-  // check mac of the downloaded file
-  guchar meta_mac_xor_calc[8];
-  chunked_cbc_mac_finish8(&data.mac, meta_mac_xor_calc);
-  if (memcmp(meta_mac_xor, meta_mac_xor_calc, 8) != 0)
-  {
-    g_set_error(err, MEGA_ERROR, MEGA_ERROR_OTHER, "MAC mismatch");
-    goto err;
-  }
 
-  // rename downloaded file, e.g. remove ".partial"
-  file = g_file_set_display_name(file, orig_fname, NULL, &local_err);
-  if (!file)
+  if (!http_get_stream_download(h, range_url, (http_data_fn)get_range_process_data, &data, end - start + 1, 0, &local_err))
   {
-    g_propagate_prefixed_error(err, local_err, "Failed to rename file: ");
-    goto err;
+    g_propagate_prefixed_error(err, local_err, "Data download failed: ");
+    return FALSE;
   }
 
   return TRUE;
-
-err:
-  return FALSE;
 }
 
 // }}}
@@ -3611,6 +6113,7 @@ struct _dl_data
   guchar ecount[AES_BLOCK_SIZE];
   chunked_cbc_mac mac;
   GByteArray* buffer;
+  GByteArray* write_buffer;
 };
 
 static gsize dl_process_data(gpointer buffer, gsize size, struct _dl_data* data)
@@ -3624,15 +6127,19 @@ static gsize dl_process_data(gpointer buffer, gsize size, struct _dl_data* data)
 
   chunked_cbc_mac_update(&data->mac, data->buffer->data, size);
 
-  init_status(data->s, MEGA_STATUS_DATA);
-  data->s->status_data.data.size = size;
-  data->s->status_data.data.buf = data->buffer->data;
-  if (send_status(data->s)) 
+  mega_status_data sd;
+  init_status(&sd, MEGA_STATUS_DATA);
+  sd.data.size = size;
+  sd.data.buf = data->buffer->data;
+  if (send_status(data->s, &sd)) 
     return 0;
 
   if (!data->stream)
     return size;
 
+  if (data->write_buffer)
+    return write_buffer_append(data->stream, data->write_buffer, data->buffer->data, size) ? size : 0;
+
   if (!g_output_stream_write_all(G_OUTPUT_STREAM(data->stream), data->buffer->data, size, NULL, NULL, &local_err))
   {
     g_printerr("ERROR: Failed writing to stream: %s\n", local_err->message);
@@ -3715,6 +6222,7 @@ gboolean mega_session_dl(mega_session* s, const gchar* handle, const gchar* key,
   gc_http_free http* h = NULL;
   gc_object_unref GFileOutputStream* stream = NULL;
   gc_byte_array_unref GByteArray* buffer = NULL;
+  gc_byte_array_unref GByteArray* write_buffer = NULL;
   gboolean partial_file = FALSE;
   goffset resume_from = 0;
 
@@ -3825,10 +6333,11 @@ gboolean mega_session_dl(mega_session* s, const gchar* handle, const gchar* key,
     goto err;
   }
 
-  init_status(s, MEGA_STATUS_FILEINFO);
-  s->status_data.fileinfo.name = node_name;
-  s->status_data.fileinfo.size = file_size;
-  if (send_status(s)) 
+  mega_status_data sd;
+  init_status(&sd, MEGA_STATUS_FILEINFO);
+  sd.fileinfo.name = node_name;
+  sd.fileinfo.size = file_size;
+  if (send_status(s, &sd)) 
   {
     g_set_error(err, MEGA_ERROR, MEGA_ERROR_OTHER, "Operation cancelled from status callback");
     goto err;
@@ -3899,12 +6408,17 @@ gboolean mega_session_dl(mega_session* s, const gchar* handle, const gchar* key,
     }
   }
 
+  if (data.stream && !partial_file)
+    stream_prepare_for_size(data.stream, file_size);
+
   // initialize decryption and mac calculation
   AES_set_encrypt_key(aes_key, 128, &data.k);
   chunked_cbc_mac_init8(&data.mac, aes_key, data.iv);
 
-  // setup buffer
+  // setup buffers
   data.buffer = buffer = g_byte_array_new();
+  if (data.stream)
+    data.write_buffer = write_buffer = g_byte_array_new();
 
   if (partial_file && !partial_dl_verify_data(file, resume_from, &data, &local_err))
   {
@@ -3923,6 +6437,12 @@ gboolean mega_session_dl(mega_session* s, const gchar* handle, const gchar* key,
     goto err;
   }
 
+  if (!write_buffer_flush(data.stream, data.write_buffer))
+  {
+    g_set_error(err, MEGA_ERROR, MEGA_ERROR_OTHER, "Writing downloaded data failed");
+    goto err;
+  }
+
   if (data.stream)
   {
     if (!g_output_stream_close(G_OUTPUT_STREAM(data.stream), NULL, &local_err))
@@ -4063,6 +6583,327 @@ gboolean mega_node_is_container(mega_node* n)
 
 // }}}
 
+// {{{ binary session cache
+
+// Compact binary session cache: one AES-CBC encrypted blob of
+// length-prefixed records holding the already decrypted session state and
+// node keys. Loading is a single file read, one AES pass and a linear
+// record scan -- no JSON parsing and no per-node base64/AES work. It's
+// written next to the JSON cache (<name>.bin) and tried first on load,
+// with the JSON cache kept as the fallback.
+
+#define BIN_CACHE_MAGIC "MGC1"
+
+struct _bin_reader
+{
+  const guchar* data;
+  gsize len;
+  gsize pos;
+  gboolean ok;
+};
+
+static void bin_put_u32(GByteArray* buf, guint32 v)
+{
+  g_byte_array_append(buf, (guchar*)&v, 4);
+}
+
+static void bin_put_i64(GByteArray* buf, gint64 v)
+{
+  g_byte_array_append(buf, (guchar*)&v, 8);
+}
+
+static void bin_put_blob(GByteArray* buf, const guchar* data, guint32 len)
+{
+  if (!data)
+  {
+    bin_put_u32(buf, 0xffffffffu);
+    return;
+  }
+
+  bin_put_u32(buf, len);
+  if (len > 0)
+    g_byte_array_append(buf, data, len);
+}
+
+static void bin_put_str(GByteArray* buf, const gchar* str)
+{
+  // the terminating NUL is stored too
+  bin_put_blob(buf, (const guchar*)str, str ? strlen(str) + 1 : 0);
+}
+
+static void bin_put_bn(GByteArray* buf, BIGNUM* n)
+{
+  if (!n)
+  {
+    bin_put_u32(buf, 0xffffffffu);
+    return;
+  }
+
+  guint32 len = BN_num_bytes(n);
+  gc_free guchar* tmp = g_malloc0(len + 1);
+
+  BN_bn2bin(n, tmp);
+  bin_put_u32(buf, len);
+  if (len > 0)
+    g_byte_array_append(buf, tmp, len);
+}
+
+static gboolean bin_get_mem(struct _bin_reader* r, gpointer out, gsize len)
+{
+  if (!r->ok || r->pos + len > r->len)
+  {
+    r->ok = FALSE;
+    return FALSE;
+  }
+
+  memcpy(out, r->data + r->pos, len);
+  r->pos += len;
+  return TRUE;
+}
+
+static guint32 bin_get_u32(struct _bin_reader* r)
+{
+  guint32 v = 0;
+
+  bin_get_mem(r, &v, 4);
+  return v;
+}
+
+static gint64 bin_get_i64(struct _bin_reader* r)
+{
+  gint64 v = 0;
+
+  bin_get_mem(r, &v, 8);
+  return v;
+}
+
+static guchar* bin_get_blob(struct _bin_reader* r, gsize* len_out)
+{
+  guint32 len = bin_get_u32(r);
+
+  if (len_out)
+    *len_out = 0;
+
+  if (!r->ok || len == 0xffffffffu)
+    return NULL;
+
+  if (r->pos + len > r->len)
+  {
+    r->ok = FALSE;
+    return NULL;
+  }
+
+  guchar* data = g_memdup(r->data + r->pos, len);
+  r->pos += len;
+
+  if (len_out)
+    *len_out = len;
+
+  return data;
+}
+
+static gchar* bin_get_str(struct _bin_reader* r)
+{
+  gsize len = 0;
+  guchar* data = bin_get_blob(r, &len);
+
+  if (!data)
+    return NULL;
+
+  if (len == 0 || data[len - 1] != '\0')
+  {
+    g_free(data);
+    r->ok = FALSE;
+    return NULL;
+  }
+
+  return (gchar*)data;
+}
+
+static BIGNUM* bin_get_bn(struct _bin_reader* r)
+{
+  gsize len = 0;
+  gc_free guchar* data = bin_get_blob(r, &len);
+
+  if (!data)
+    return NULL;
+
+  return BN_bin2bn(data, len, NULL);
+}
+
+static void bin_save_share_keys(gchar* handle, guchar* key, GByteArray* buf)
+{
+  bin_put_str(buf, handle);
+  bin_put_blob(buf, key, 16);
+}
+
+static void session_save_bin(mega_session* s, const gchar* path)
+{
+  GSList* i;
+  AES_KEY k;
+  guchar iv[16];
+  GByteArray* buf = g_byte_array_new();
+
+  g_byte_array_append(buf, (guchar*)BIN_CACHE_MAGIC, 4);
+  bin_put_u32(buf, CACHE_FORMAT_VERSION);
+  bin_put_i64(buf, s->last_refresh);
+  bin_put_str(buf, s->sn);
+  bin_put_str(buf, s->sid);
+  bin_put_blob(buf, s->password_key, 16);
+  bin_put_blob(buf, s->master_key, 16);
+  bin_put_bn(buf, s->rsa_key.p);
+  bin_put_bn(buf, s->rsa_key.q);
+  bin_put_bn(buf, s->rsa_key.d);
+  bin_put_bn(buf, s->rsa_key.u);
+  bin_put_bn(buf, s->rsa_key.m);
+  bin_put_bn(buf, s->rsa_key.e);
+  bin_put_str(buf, s->user_handle);
+  bin_put_str(buf, s->user_name);
+  bin_put_str(buf, s->user_email);
+
+  bin_put_u32(buf, g_hash_table_size(s->share_keys));
+  g_hash_table_foreach(s->share_keys, (GHFunc)bin_save_share_keys, buf);
+
+  bin_put_u32(buf, g_slist_length(s->fs_nodes));
+  for (i = s->fs_nodes; i; i = i->next)
+  {
+    mega_node* n = i->data;
+
+    bin_put_str(buf, n->name);
+    bin_put_str(buf, n->handle);
+    bin_put_str(buf, n->parent_handle);
+    bin_put_str(buf, n->user_handle);
+    bin_put_str(buf, n->su_handle);
+    bin_put_blob(buf, n->key, n->key_len);
+    bin_put_u32(buf, n->type);
+    bin_put_i64(buf, n->size);
+    bin_put_i64(buf, n->timestamp);
+    bin_put_str(buf, n->link);
+  }
+
+  // zero-pad to the AES block size (records are self-delimiting) and
+  // encrypt with the password key
+  gsize data_len = buf->len;
+  gsize padded_len = (data_len + 15) & ~(gsize)15;
+  g_byte_array_set_size(buf, padded_len);
+  memset(buf->data + data_len, 0, padded_len - data_len);
+
+  gc_free guchar* cipher = g_malloc(padded_len);
+  memset(iv, 0, 16);
+  AES_set_encrypt_key(s->password_key, 128, &k);
+  AES_cbc_encrypt(buf->data, cipher, padded_len, &k, iv, AES_ENCRYPT);
+
+  g_file_set_contents(path, (gchar*)cipher, padded_len, NULL);
+
+  g_byte_array_free(buf, TRUE);
+}
+
+static gboolean session_load_bin(mega_session* s, const gchar* path, const guchar* password_key, gint max_age, gchar** last_sid)
+{
+  gc_free gchar* cipher = NULL;
+  gsize cipher_len = 0;
+  guint32 i, count;
+  gchar magic[4];
+  guchar iv[16];
+  AES_KEY k;
+  gsize len;
+
+  if (!g_file_get_contents(path, &cipher, &cipher_len, NULL))
+    return FALSE;
+
+  if (cipher_len < 16 || (cipher_len % 16) != 0)
+    return FALSE;
+
+  gc_free guchar* data = g_malloc(cipher_len);
+  memset(iv, 0, 16);
+  AES_set_decrypt_key(password_key, 128, &k);
+  AES_cbc_encrypt((guchar*)cipher, data, cipher_len, &k, iv, AES_DECRYPT);
+
+  struct _bin_reader r = { data, cipher_len, 0, TRUE };
+
+  // wrong password or corruption shows up as a broken magic
+  if (!bin_get_mem(&r, magic, 4) || memcmp(magic, BIN_CACHE_MAGIC, 4) != 0)
+    return FALSE;
+
+  if (bin_get_u32(&r) != CACHE_FORMAT_VERSION)
+    return FALSE;
+
+  gint64 last_refresh = bin_get_i64(&r);
+
+  // check max_age before populating anything; the JSON fallback reports
+  // the timeout to the caller
+  if (max_age > 0 && (!last_refresh || ((last_refresh + max_age) < time(NULL))))
+    return FALSE;
+
+  s->last_refresh = last_refresh;
+  s->sn = bin_get_str(&r);
+  s->sid = bin_get_str(&r);
+  s->password_key = bin_get_blob(&r, &len);
+  s->master_key = bin_get_blob(&r, &len);
+  s->rsa_key.p = bin_get_bn(&r);
+  s->rsa_key.q = bin_get_bn(&r);
+  s->rsa_key.d = bin_get_bn(&r);
+  s->rsa_key.u = bin_get_bn(&r);
+  s->rsa_key.m = bin_get_bn(&r);
+  s->rsa_key.e = bin_get_bn(&r);
+  s->user_handle = bin_get_str(&r);
+  s->user_name = bin_get_str(&r);
+  s->user_email = bin_get_str(&r);
+
+  if (!r.ok || !s->sid || !s->password_key || !s->master_key || !s->user_handle || !s->user_email || !s->rsa_key.p || !s->rsa_key.q || !s->rsa_key.d || !s->rsa_key.u)
+    goto err;
+
+  count = bin_get_u32(&r);
+  for (i = 0; r.ok && i < count; i++)
+  {
+    gc_free gchar* handle = bin_get_str(&r);
+    gc_free guchar* key = bin_get_blob(&r, &len);
+
+    if (!handle || !key || len != 16)
+      goto err;
+
+    add_share_key(s, handle, key);
+  }
+
+  count = bin_get_u32(&r);
+  for (i = 0; r.ok && i < count; i++)
+  {
+    mega_node* n = g_new0(mega_node, 1);
+
+    s->fs_nodes = g_slist_prepend(s->fs_nodes, n);
+
+    n->name = bin_get_str(&r);
+    n->handle = bin_get_str(&r);
+    n->parent_handle = bin_get_str(&r);
+    n->user_handle = bin_get_str(&r);
+    n->su_handle = bin_get_str(&r);
+    n->key = bin_get_blob(&r, &n->key_len);
+    n->type = bin_get_u32(&r);
+    n->size = bin_get_i64(&r);
+    n->timestamp = bin_get_i64(&r);
+    n->link = bin_get_str(&r);
+
+    if (!n->handle)
+      goto err;
+  }
+
+  if (!r.ok)
+    goto err;
+
+  s->fs_nodes = g_slist_reverse(s->fs_nodes);
+
+  if (last_sid)
+    *last_sid = g_strdup(s->sid);
+
+  return TRUE;
+
+err:
+  // leave a clean session for the JSON fallback
+  mega_session_close(s);
+  return FALSE;
+}
+
+// }}}
 // {{{ mega_session_save
 
 static void save_share_keys(gchar* handle, gchar* key, SJsonGen* gen)
@@ -4082,6 +6923,11 @@ gboolean mega_session_save(mega_session* s, GError** err)
   g_return_val_if_fail(s->user_email != NULL, FALSE);
   g_return_val_if_fail(err == NULL || *err == NULL, FALSE);
 
+  // a narrowed session holds only a part of the tree, writing it out
+  // would lose the rest of the cached filesystem
+  if (s->narrowed)
+    return TRUE;
+
   // calculate cache file path
   gc_free gchar* un = g_ascii_strdown(s->user_email, -1);
   gc_checksum_free GChecksum* cs = g_checksum_new(G_CHECKSUM_SHA1);
@@ -4095,6 +6941,7 @@ gboolean mega_session_save(mega_session* s, GError** err)
   // serialize session object
   s_json_gen_member_int(gen, "version", CACHE_FORMAT_VERSION);
   s_json_gen_member_int(gen, "last_refresh", s->last_refresh);
+  s_json_gen_member_string(gen, "sn", s->sn);
 
   s_json_gen_member_string(gen, "sid", s->sid);
   s_json_gen_member_bytes(gen, "password_key", s->password_key, 16);
@@ -4143,6 +6990,11 @@ gboolean mega_session_save(mega_session* s, GError** err)
     return FALSE;
   }
 
+  // also write the binary cache (loaded preferentially, JSON is the
+  // fallback)
+  gc_free gchar* path_bin = g_strconcat(path, ".bin", NULL);
+  session_save_bin(s, path_bin);
+
   return TRUE;
 }
 
@@ -4175,8 +7027,23 @@ gboolean mega_session_load(mega_session* s, const gchar* un, const gchar* pw, gi
     return FALSE;
   }
 
-  // calculate password key
-  gc_free guchar* password_key = make_password_key(pw);
+  // calculate password key, reusing the cached derived key when available
+  gc_free guchar* password_key = pkey_cache_load(s, un_lower, pw);
+  if (!password_key)
+  {
+    password_key = make_password_key(pw);
+    pkey_cache_save(s, un_lower, pw, password_key);
+  }
+
+  // try the binary cache first, it holds the same data but loads without
+  // JSON parsing and per-field decoding
+  gc_free gchar* path_bin = g_strconcat(path, ".bin", NULL);
+  if (session_load_bin(s, path_bin, password_key, max_age, last_sid))
+  {
+    update_pathmap(s);
+    return TRUE;
+  }
+
   gsize len = 0;
   gc_free gchar* data = b64_aes128_cbc_decrypt(cipher, password_key, &len);
 
@@ -4233,6 +7100,7 @@ gboolean mega_session_load(mega_session* s, const gchar* un, const gchar* pw, gi
     gsize len;
 
     s->last_refresh = last_refresh;
+    s->sn = s_json_get_member_string(cache_obj, "sn");
     s->sid = sid; sid = NULL;
     s->password_key = s_json_get_member_bytes(cache_obj, "password_key", &len);
     s->master_key = s_json_get_member_bytes(cache_obj, "master_key", &len);
@@ -144,10 +144,17 @@ mega_session*       mega_session_new                (void);
 void                mega_session_free               (mega_session* s);
 
 void                mega_session_set_speed          (mega_session* s, gint ul, gint dl);
+void                mega_session_set_workers        (mega_session* s, gint workers);
 void                mega_session_set_proxy          (mega_session* s, const gchar* proxy);
 
 void                mega_session_watch_status       (mega_session* s, mega_status_callback cb, gpointer userdata);
 void                mega_session_enable_previews    (mega_session* s, gboolean enable);
+// caching of the derived password key skips the slow KDF on warm starts
+void                mega_session_enable_pkey_cache  (mega_session* s, gboolean enable);
+// restrict the in-memory tree to remote_path's ancestors and subtree, so
+// path-scoped operations on huge accounts don't traverse the whole tree;
+// a narrowed session is never written back to the session cache
+void                mega_session_narrow             (mega_session* s, const gchar* remote_path);
 
 // this has side effect of the current session being closed
 gboolean            mega_session_open               (mega_session* s, const gchar* un, const gchar* pw, const gchar* sid, GError** err);
@@ -158,6 +165,11 @@ gboolean            mega_session_save               (mega_session* s, GError** e
 // this has side effect of the current session being closed
 gboolean            mega_session_load               (mega_session* s, const gchar* un, const gchar* pw, gint max_age, gchar** last_sid, GError** err);
 
+// batched API command submission (only calls that don't need a response
+// body can be batched)
+void                mega_session_batch_begin        (mega_session* s);
+gboolean            mega_session_batch_commit       (mega_session* s, GError** err);
+
 gboolean            mega_session_get_user           (mega_session* s, GError** err);
 gboolean            mega_session_refresh            (mega_session* s, GError** err);
 gboolean            mega_session_addlinks           (mega_session* s, GSList* nodes, GError** err);
@@ -165,13 +177,27 @@ mega_user_quota*    mega_session_user_quota         (mega_session* s, GError** e
 
 GSList*             mega_session_ls_all             (mega_session* s);
 GSList*             mega_session_ls                 (mega_session* s, const gchar* path, gboolean recursive);
+// streaming variant: walks the children index depth-first with each
+// directory sorted by name and emits nodes as it goes, with O(directory)
+// memory; return FALSE from the callback to stop the walk (the function
+// then returns FALSE too)
+typedef gboolean (*mega_node_cb)(mega_node* n, gpointer userdata);
+gboolean            mega_session_ls_foreach         (mega_session* s, const gchar* path, gboolean recursive, mega_node_cb cb, gpointer userdata);
 GSList*             mega_session_get_node_chilren   (mega_session* s, mega_node* node);
 mega_node*          mega_session_stat               (mega_session* s, const gchar* path);
 mega_node*          mega_session_mkdir              (mega_session* s, const gchar* path, GError** err);
+// bulk variant: creates whole directory levels with one API call per
+// (level, parent) batch instead of one call per directory; existing
+// folders in the list are skipped, parents must exist already or come
+// earlier in the list
+gboolean            mega_session_mkdir_bulk         (mega_session* s, GSList* paths, GError** err);
 gboolean            mega_session_rm                 (mega_session* s, const gchar* path, GError** err);
 mega_node*          mega_session_put                (mega_session* s, const gchar* remote_path, const gchar* local_path, GError** err);
 gchar*              mega_session_new_node_attribute (mega_session* s, const guchar* data, gsize len, const gchar* type, const guchar* key, GError** err);
 gboolean            mega_session_get                (mega_session* s, const gchar* local_path, const gchar* remote_path, GError** err);
+// partial download exploiting AES-CTR seekability; data is delivered via
+// MEGA_STATUS_DATA, integrity of partial data can't be verified
+gboolean            mega_session_get_range          (mega_session* s, const gchar* remote_path, guint64 offset, guint64 length, GError** err);
 
 gboolean            mega_session_open_exp_folder    (mega_session* s, const gchar* n, const gchar* key, const gchar* specific, GError** err);
 gboolean            mega_session_dl                 (mega_session* s, const gchar* handle, const gchar* key, const gchar* local_path, GError** err);
@@ -0,0 +1,135 @@
+/*
+ *  megatools - Mega.nz client library and tools
+ *  Copyright (C) 2013  Ondřej Jirman <megous@megous.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+
+#include "profile.h"
+
+gint mega_profile_enabled = 0;
+
+// latency histogram bucket upper bounds (us); the last bucket is open-ended
+static const gint64 bucket_limits[] = { 10000, 50000, 100000, 500000, 1000000 };
+
+#define N_BUCKETS (G_N_ELEMENTS(bucket_limits) + 1)
+
+struct phase_stats
+{
+  guint64 count;
+  gint64 total_us;
+  gint64 max_us;
+  guint64 bytes;
+  guint64 buckets[N_BUCKETS];
+};
+
+static GMutex profile_lock;
+static GHashTable* phases; // gchar* phase name -> struct phase_stats*
+
+void mega_profile_add(const gchar* phase, gint64 span_us, guint64 bytes)
+{
+  struct phase_stats* st;
+  guint i;
+
+  g_return_if_fail(phase != NULL);
+
+  if (span_us < 0)
+    span_us = 0;
+
+  g_mutex_lock(&profile_lock);
+
+  if (!phases)
+    phases = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+  st = g_hash_table_lookup(phases, phase);
+  if (!st)
+  {
+    st = g_new0(struct phase_stats, 1);
+    g_hash_table_insert(phases, g_strdup(phase), st);
+  }
+
+  st->count++;
+  st->total_us += span_us;
+  st->max_us = MAX(st->max_us, span_us);
+  st->bytes += bytes;
+
+  for (i = 0; i < G_N_ELEMENTS(bucket_limits); i++)
+    if (span_us < bucket_limits[i])
+      break;
+  st->buckets[i]++;
+
+  g_mutex_unlock(&profile_lock);
+}
+
+static gint compare_phase_names(gconstpointer a, gconstpointer b)
+{
+  return strcmp(a, b);
+}
+
+void mega_profile_dump(void)
+{
+  GList *keys, *k;
+
+  g_mutex_lock(&profile_lock);
+
+  if (!phases || g_hash_table_size(phases) == 0)
+  {
+    g_mutex_unlock(&profile_lock);
+    return;
+  }
+
+  g_printerr("\nPROFILE: %-24s %8s %10s %9s %9s %12s\n", "phase", "calls", "total", "avg", "max", "rate");
+
+  keys = g_list_sort(g_hash_table_get_keys(phases), compare_phase_names);
+
+  for (k = keys; k; k = k->next)
+  {
+    struct phase_stats* st = g_hash_table_lookup(phases, k->data);
+    gdouble total_s = st->total_us / 1e6;
+
+    g_printerr("PROFILE: %-24s %8" G_GUINT64_FORMAT " %9.3fs %7.1fms %7.1fms",
+      (gchar*)k->data, st->count, total_s,
+      st->total_us / 1000.0 / st->count, st->max_us / 1000.0);
+
+    if (st->bytes > 0 && total_s > 0)
+    {
+      gchar* rate_str = g_format_size_full(st->bytes / total_s, G_FORMAT_SIZE_IEC_UNITS);
+      g_printerr(" %10s/s", rate_str);
+      g_free(rate_str);
+    }
+
+    g_printerr("\n");
+
+    if (st->count > 1)
+    {
+      guint i;
+
+      g_printerr("PROFILE: %-24s  ", "");
+      for (i = 0; i < N_BUCKETS; i++)
+      {
+        if (i < G_N_ELEMENTS(bucket_limits))
+          g_printerr(" <%ldms:%" G_GUINT64_FORMAT, (long)(bucket_limits[i] / 1000), st->buckets[i]);
+        else
+          g_printerr(" rest:%" G_GUINT64_FORMAT, st->buckets[i]);
+      }
+      g_printerr("\n");
+    }
+  }
+
+  g_list_free(keys);
+  g_mutex_unlock(&profile_lock);
+}
@@ -0,0 +1,46 @@
+/*
+ *  megatools - Mega.nz client library and tools
+ *  Copyright (C) 2013  Ondřej Jirman <megous@megous.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __MEGA_PROFILE_H
+#define __MEGA_PROFILE_H
+
+#include <glib.h>
+
+// Wall-time accounting of named phases (API calls, crypto, stream writes,
+// TLS handshakes), enabled with --profile. Recording is cheap and
+// thread-safe; the summary is printed by mega_profile_dump at tool exit.
+
+extern gint mega_profile_enabled;
+
+void mega_profile_add(const gchar* phase, gint64 span_us, guint64 bytes);
+void mega_profile_dump(void);
+
+// span helpers: MEGA_PROFILE_BEGIN declares a timestamp variable, so it
+// must come before any statements in pre-C99 style blocks
+
+#define MEGA_PROFILE_BEGIN(v) \
+  gint64 v = mega_profile_enabled ? g_get_monotonic_time() : 0
+
+#define MEGA_PROFILE_END(v, phase, bytes) \
+  G_STMT_START { \
+    if (mega_profile_enabled) \
+      mega_profile_add(phase, g_get_monotonic_time() - (v), bytes); \
+  } G_STMT_END
+
+#endif
@@ -599,6 +599,21 @@ gboolean s_json_string_match(const gchar* json_str, const gchar* c_str)
     return FALSE;
   }
 }
+const gchar* s_json_string_view(const gchar* json_str, gsize* len)
+{
+  const gchar *start, *end;
+
+  g_return_val_if_fail(json_str != NULL, NULL);
+  g_return_val_if_fail(len != NULL, NULL);
+
+  // only strings without escape sequences can be handed out in place
+  if (s_json_get_token(json_str, &start, &end) != TOK_NOESC_STRING)
+    return NULL;
+
+  *len = (end - start) - 2;
+  return start + 1;
+}
+
 
 // helpers
 
@@ -614,6 +629,18 @@ gchar* s_json_get_member_string(const gchar* json, const gchar* name)
   return NULL;
 }
 
+const gchar* s_json_get_member_string_view(const gchar* json, const gchar* name, gsize* len)
+{
+  g_return_val_if_fail(json != NULL, NULL);
+  g_return_val_if_fail(name != NULL, NULL);
+
+  const gchar* member = s_json_get_member(json, name);
+  if (member)
+    return s_json_string_view(member, len);
+
+  return NULL;
+}
+
 gint64 s_json_get_member_int(const gchar* json, const gchar* name, gint64 fallback)
 {
   g_return_val_if_fail(json != NULL, fallback);
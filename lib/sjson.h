@@ -71,6 +71,13 @@ gboolean       s_json_member_is_null        (const gchar* json, const gchar* nam
 
 gboolean       s_json_string_match          (const gchar* json_str, const gchar* c_str);
 
+// zero-copy access to string values without escape sequences (NULL is
+// returned for strings that need unescaping, fall back to
+// s_json_get_string for those)
+
+const gchar*   s_json_string_view           (const gchar* json_str, gsize* len);
+const gchar*   s_json_get_member_string_view(const gchar* json, const gchar* name, gsize* len);
+
 // json path
 
 const gchar*   s_json_path                  (const gchar* json, const gchar* path);
@@ -24,6 +24,7 @@
 
 #include "config.h"
 #include "tools.h"
+#include "profile.h"
 
 #ifdef G_OS_WIN32
 #include <windows.h>
@@ -47,13 +48,17 @@ static gboolean opt_reload_files;
 static gboolean opt_version;
 static gboolean opt_no_config;
 static gboolean opt_no_ask_password;
+static gboolean opt_profile;
 static gint opt_speed_limit = -1; /* -1 means limit not set */
+static gint opt_workers = -1; /* -1 means not set */
 static gchar* opt_proxy;
 
 static gchar* proxy;
 static gint upload_speed_limit;
 static gint download_seed_limit;
+static gint transfer_workers = 1;
 static gint cache_timout = 10 * 60;
+static gboolean cache_password_key = TRUE;
 
 static gboolean opt_debug_callback(const gchar *option_name, const gchar *value, gpointer data, GError **error)
 {
@@ -87,6 +92,7 @@ static GOptionEntry basic_options[] =
   { "config",             '\0',  0,                          G_OPTION_ARG_FILENAME, &opt_config,        "Load configuration from a file",               "PATH"  },
   { "ignore-config-file", '\0',  0,                          G_OPTION_ARG_NONE,     &opt_no_config,     "Disable loading " MEGA_RC_FILENAME,            NULL    },
   { "debug",              '\0',  G_OPTION_FLAG_OPTIONAL_ARG, G_OPTION_ARG_CALLBACK, opt_debug_callback, "Enable debugging output",                      "OPTS"  },
+  { "profile",            '\0',  0,                          G_OPTION_ARG_NONE,     &opt_profile,       "Print per-phase timing summary at exit",       NULL    },
   { "version",            '\0',  0,                          G_OPTION_ARG_NONE,     &opt_version,       "Show version information",                     NULL    },
   { NULL }
 };
@@ -103,6 +109,7 @@ static GOptionEntry auth_options[] =
 static GOptionEntry network_options[] =
 {
   { "limit-speed",        '\0',  0, G_OPTION_ARG_INT,       &opt_speed_limit,      "Limit transfer speed (KiB/s)",    "SPEED"  },
+  { "workers",            '\0',  0, G_OPTION_ARG_INT,       &opt_workers,          "Number of parallel transfer connections", "NUM" },
   { "proxy",              '\0',  0, G_OPTION_ARG_STRING,    &opt_proxy,            "Proxy setup string",              "PROXY"  },
   { NULL }
 };
@@ -389,6 +396,9 @@ void tool_init(gint* ac, gchar*** av, const gchar* tool_name, GOptionEntry* tool
 
   print_version();
 
+  if (opt_profile)
+    mega_profile_enabled = 1;
+
   if (!opt_no_config || opt_config)
   {
     gboolean status = TRUE;
@@ -428,6 +438,11 @@ void tool_init(gint* ac, gchar*** av, const gchar* tool_name, GOptionEntry* tool
       else
         g_clear_error(&local_err);
 
+      // opt-out for environments that don't want the derived password key
+      // on disk
+      if (g_key_file_has_key(kf, "Cache", "PasswordKeyCache", NULL))
+        cache_password_key = g_key_file_get_boolean(kf, "Cache", "PasswordKeyCache", NULL);
+
       // Load speed limits from settings file
       if (g_key_file_has_key(kf, "Network", "SpeedLimit", NULL))
       {
@@ -459,6 +474,17 @@ void tool_init(gint* ac, gchar*** av, const gchar* tool_name, GOptionEntry* tool
         }
       }
 
+      if (g_key_file_has_key(kf, "Network", "Workers", NULL))
+      {
+        transfer_workers = g_key_file_get_integer(kf, "Network", "Workers", &local_err);
+        if (local_err)
+        {
+          g_printerr("WARNING: Invalid workers count set in the config file: %s\n", local_err->message);
+          g_clear_error(&local_err);
+          transfer_workers = 1;
+        }
+      }
+
       proxy = g_key_file_get_string(kf, "Network", "Proxy", NULL);
     }
   }
@@ -469,6 +495,9 @@ void tool_init(gint* ac, gchar*** av, const gchar* tool_name, GOptionEntry* tool
     download_seed_limit = opt_speed_limit;
   }
 
+  if (opt_workers >= 0)
+    transfer_workers = opt_workers;
+
   if (opt_proxy)
   {
     if (!strcmp(opt_proxy, "none"))
@@ -505,6 +534,8 @@ mega_session* tool_start_session(ToolSessionFlags flags)
   mega_session* s = mega_session_new();
 
   mega_session_set_speed(s, upload_speed_limit, download_seed_limit);
+  mega_session_set_workers(s, transfer_workers);
+  mega_session_enable_pkey_cache(s, cache_password_key);
 
   if (proxy)
     mega_session_set_proxy(s, proxy);
@@ -520,20 +551,30 @@ mega_session* tool_start_session(ToolSessionFlags flags)
   {
     g_clear_error(&local_err);
 
-    if (!mega_session_open(s, opt_username, opt_password, sid, &local_err))
+    // try to reuse a timed out cache: load it ignoring the age and let
+    // mega_session_refresh update it incrementally
+    if (mega_session_load(s, opt_username, opt_password, 0, NULL, NULL) && mega_session_refresh(s, NULL))
     {
-      g_printerr("ERROR: Can't login to mega.nz: %s\n", local_err->message);
-      goto err;
+      loaded = TRUE;
+      mega_session_save(s, NULL);
     }
-
-    if (!mega_session_refresh(s, &local_err))
+    else
     {
-      g_printerr("ERROR: Can't read filesystem info from mega.nz: %s\n", local_err->message);
-      goto err;
-    }
+      if (!mega_session_open(s, opt_username, opt_password, sid, &local_err))
+      {
+        g_printerr("ERROR: Can't login to mega.nz: %s\n", local_err->message);
+        goto err;
+      }
 
-    loaded = TRUE;
-    mega_session_save(s, NULL);
+      if (!mega_session_refresh(s, &local_err))
+      {
+        g_printerr("ERROR: Can't read filesystem info from mega.nz: %s\n", local_err->message);
+        goto err;
+      }
+
+      loaded = TRUE;
+      mega_session_save(s, NULL);
+    }
   }
 
   if (opt_reload_files && !loaded)
@@ -559,6 +600,9 @@ err:
 
 void tool_fini(mega_session* s)
 {
+  if (mega_profile_enabled)
+    mega_profile_dump();
+
   if (s)
     mega_session_free(s);
 
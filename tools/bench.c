@@ -0,0 +1,319 @@
+/*
+ *  megatools - Mega.nz client library and tools
+ *  Copyright (C) 2013  Ondřej Jirman <megous@megous.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Micro-benchmarks for the CPU-bound kernels of the library: AES-CTR
+// payload crypto, chunked CBC-MAC, base64url and key decoding, RSA private
+// key unpacking and sjson parsing. Inputs are synthesized with a seeded
+// PRNG, so numbers are reproducible across runs and comparable across
+// commits.
+//
+// The kernels are static functions of mega.c by design (they are
+// implementation details, not library API), so the whole translation unit
+// is included here instead of linking against libmega.a.
+
+#include "mega.c"
+
+// {{{ reporting
+
+static gint64 bench_start;
+
+static void bench_begin(void)
+{
+  bench_start = g_get_monotonic_time();
+}
+
+static void bench_end(const gchar* name, guint64 bytes, guint64 ops)
+{
+  gint64 elapsed = g_get_monotonic_time() - bench_start;
+
+  if (elapsed <= 0)
+    elapsed = 1;
+
+  g_print("%-32s", name);
+
+  if (bytes > 0)
+    g_print(" %10.1f MB/s", (gdouble)bytes / (1024.0 * 1024.0) / ((gdouble)elapsed / 1e6));
+  else
+    g_print(" %15s", "");
+
+  if (ops > 0)
+    g_print(" %12.0f ns/op", (gdouble)elapsed * 1000.0 / (gdouble)ops);
+
+  g_print("\n");
+}
+
+// }}}
+// {{{ synthetic inputs
+
+static GRand* rnd;
+
+static guchar* make_buffer(gsize size)
+{
+  guchar* buf = g_malloc(size);
+  gsize i;
+
+  for (i = 0; i < size; i++)
+    buf[i] = g_rand_int(rnd);
+
+  return buf;
+}
+
+// }}}
+// {{{ AES-CTR
+
+#define CTR_BUFFER_SIZE (64 * 1024 * 1024)
+#define CTR_ITERATIONS 4
+
+static void bench_aes_ctr(void)
+{
+  gc_free guchar* buf = make_buffer(CTR_BUFFER_SIZE);
+  guchar key[16], nonce[8], iv[AES_BLOCK_SIZE], ecount[AES_BLOCK_SIZE];
+  AES_KEY k;
+  guint num, i;
+
+  for (i = 0; i < sizeof(key); i++)
+    key[i] = g_rand_int(rnd);
+  for (i = 0; i < sizeof(nonce); i++)
+    nonce[i] = g_rand_int(rnd);
+
+  AES_set_encrypt_key(key, 128, &k);
+
+  bench_begin();
+  for (i = 0; i < CTR_ITERATIONS; i++)
+  {
+    num = 0;
+    memset(ecount, 0, sizeof(ecount));
+    make_ctr_iv(iv, nonce, 0);
+    AES_ctr128_encrypt(buf, buf, CTR_BUFFER_SIZE, &k, iv, ecount, &num);
+  }
+  bench_end("AES_ctr128_encrypt", (guint64)CTR_BUFFER_SIZE * CTR_ITERATIONS, 0);
+
+  bench_begin();
+  for (i = 0; i < CTR_ITERATIONS; i++)
+    aes128_ctr_process_mt(key, nonce, 0, buf, CTR_BUFFER_SIZE);
+  bench_end("aes128_ctr_process_mt", (guint64)CTR_BUFFER_SIZE * CTR_ITERATIONS, 0);
+
+  bench_begin();
+  for (i = 0; i < CTR_ITERATIONS; i++)
+  {
+    chunked_cbc_mac mac;
+
+    chunked_cbc_mac_init8(&mac, key, nonce);
+    chunked_cbc_mac_update(&mac, buf, CTR_BUFFER_SIZE);
+  }
+  bench_end("chunked_cbc_mac_update", (guint64)CTR_BUFFER_SIZE * CTR_ITERATIONS, 0);
+}
+
+// }}}
+// {{{ base64url / key decoding
+
+#define B64_BLOB_SIZE (4 * 1024 * 1024)
+#define B64_BLOB_ITERATIONS 64
+#define B64_KEY_ITERATIONS 500000
+
+static void bench_base64(void)
+{
+  gc_free guchar* blob = make_buffer(B64_BLOB_SIZE);
+  gc_free gchar* blob_str = base64urlencode(blob, B64_BLOB_SIZE);
+  gc_free guchar* key = make_buffer(32);
+  gc_free guchar* master_key = make_buffer(16);
+  gc_free gchar* key_str = base64urlencode(key, 32);
+  gc_free gchar* enc_key_str = b64_aes128_encrypt(key, 32, master_key);
+  gsize len;
+  guint i;
+
+  bench_begin();
+  for (i = 0; i < B64_BLOB_ITERATIONS; i++)
+  {
+    guchar* data = base64urldecode(blob_str, &len);
+    g_free(data);
+  }
+  bench_end("base64urldecode (4M blob)", (guint64)B64_BLOB_SIZE * B64_BLOB_ITERATIONS, B64_BLOB_ITERATIONS);
+
+  bench_begin();
+  for (i = 0; i < B64_KEY_ITERATIONS; i++)
+  {
+    guchar* data = base64urldecode(key_str, &len);
+    g_free(data);
+  }
+  bench_end("base64urldecode (node key)", 0, B64_KEY_ITERATIONS);
+
+  bench_begin();
+  for (i = 0; i < B64_KEY_ITERATIONS; i++)
+  {
+    guchar* data = b64_aes128_decrypt(enc_key_str, master_key, &len);
+    g_free(data);
+  }
+  bench_end("b64_aes128_decrypt", 0, B64_KEY_ITERATIONS);
+}
+
+// }}}
+// {{{ RSA private key unpacking
+
+#define PRIVK_ITERATIONS 20000
+
+static void bench_privk(void)
+{
+  gc_free guchar* master_key = make_buffer(16);
+  rsa_key rsa;
+  guint i;
+
+  // synthesize a structurally valid privk blob; the values don't need to
+  // form a working RSA key, only to exercise the MPI parsing path
+  memset(&rsa, 0, sizeof(rsa));
+  rsa.p = BN_new();
+  rsa.q = BN_new();
+  rsa.d = BN_new();
+  rsa.u = BN_new();
+  BN_rand(rsa.p, 1024, 0, 1);
+  BN_rand(rsa.q, 1024, 0, 1);
+  BN_rand(rsa.d, 2048, 0, 1);
+  BN_rand(rsa.u, 1024, 0, 1);
+
+  gc_free gchar* privk_str = b64_aes128_encrypt_privk(master_key, &rsa);
+  rsa_key_free(&rsa);
+
+  bench_begin();
+  for (i = 0; i < PRIVK_ITERATIONS; i++)
+  {
+    rsa_key parsed;
+
+    memset(&parsed, 0, sizeof(parsed));
+    if (!b64_aes128_decrypt_privk(privk_str, master_key, &parsed))
+    {
+      g_printerr("ERROR: privk roundtrip failed\n");
+      return;
+    }
+
+    rsa_key_free(&parsed);
+  }
+  bench_end("b64_aes128_decrypt_privk", 0, PRIVK_ITERATIONS);
+}
+
+// }}}
+// {{{ sjson parsing
+
+#define SJSON_NODES 10000
+#define SJSON_ITERATIONS 20
+
+static gchar* make_nodes_json(void)
+{
+  SJsonGen* gen = s_json_gen_new();
+  guint i;
+
+  s_json_gen_start_array(gen);
+  for (i = 0; i < SJSON_NODES; i++)
+  {
+    gc_free guchar* handle = make_buffer(6);
+    gc_free gchar* handle_str = base64urlencode(handle, 6);
+    gc_free guchar* node_key = make_buffer(32);
+    gc_free gchar* node_key_str = base64urlencode(node_key, 32);
+    gc_free guchar* attrs = make_buffer(48);
+    gc_free gchar* attrs_str = base64urlencode(attrs, 48);
+
+    s_json_gen_start_object(gen);
+    s_json_gen_member_string(gen, "h", handle_str);
+    s_json_gen_member_string(gen, "p", handle_str);
+    s_json_gen_member_string(gen, "u", handle_str);
+    s_json_gen_member_int(gen, "t", 0);
+    s_json_gen_member_int(gen, "ts", 1400000000 + i);
+    s_json_gen_member_int(gen, "s", g_rand_int(rnd));
+    s_json_gen_member_string(gen, "k", node_key_str);
+    s_json_gen_member_string(gen, "a", attrs_str);
+    s_json_gen_end_object(gen);
+  }
+  s_json_gen_end_array(gen);
+
+  return s_json_gen_done(gen);
+}
+
+static void bench_sjson(const gchar* json)
+{
+  gsize json_len = strlen(json);
+  guint64 nodes = 0;
+  guint i;
+
+  bench_begin();
+  for (i = 0; i < SJSON_ITERATIONS; i++)
+  {
+    if (!s_json_is_valid(json))
+    {
+      g_printerr("ERROR: invalid benchmark json\n");
+      return;
+    }
+
+    S_JSON_FOREACH_ELEMENT(json, node)
+      gc_free gchar* handle = s_json_get_member_string(node, "h");
+      gc_free gchar* node_key = s_json_get_member_string(node, "k");
+      gint64 type = s_json_get_member_int(node, "t", -1);
+      gint64 size = s_json_get_member_int(node, "s", -1);
+
+      if (handle && node_key && type >= 0 && size >= 0)
+        nodes++;
+    S_JSON_FOREACH_END()
+  }
+  bench_end("sjson node parse", (guint64)json_len * SJSON_ITERATIONS, nodes);
+}
+
+// }}}
+
+int main(int ac, char* av[])
+{
+  // fixed seed keeps inputs identical from run to run
+  rnd = g_rand_new_with_seed(0x6d656761);
+
+  g_print("%-32s %15s %18s\n", "benchmark", "throughput", "latency");
+
+  bench_aes_ctr();
+  bench_base64();
+  bench_privk();
+
+  if (ac > 1)
+  {
+    // optional captured payload (a file with one json document per line)
+    gc_free gchar* data = NULL;
+
+    if (!g_file_get_contents(av[1], &data, NULL, NULL))
+    {
+      g_printerr("ERROR: Can't read %s\n", av[1]);
+      return 1;
+    }
+
+    gchar** lines = g_strsplit(data, "\n", 0);
+    gint i;
+
+    for (i = 0; lines[i]; i++)
+    {
+      g_strstrip(lines[i]);
+      if (lines[i][0] && s_json_is_valid(lines[i]))
+        bench_sjson(lines[i]);
+    }
+
+    g_strfreev(lines);
+  }
+  else
+  {
+    gc_free gchar* json = make_nodes_json();
+
+    bench_sjson(json);
+  }
+
+  g_rand_free(rnd);
+  return 0;
+}
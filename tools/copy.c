@@ -25,6 +25,7 @@ static gboolean opt_download;
 static gboolean opt_noprogress;
 static gboolean opt_dryrun;
 static gboolean opt_no_previews;
+static gint opt_parallel = 1;
 static mega_session* s;
 
 static GOptionEntry entries[] =
@@ -35,22 +36,315 @@ static GOptionEntry entries[] =
   { "no-progress",       '\0',  0, G_OPTION_ARG_NONE,    &opt_noprogress,   "Disable progress bar",             NULL    },
   { "dryrun",            'n',   0, G_OPTION_ARG_NONE,    &opt_dryrun,       "Don't perform any actual changes", NULL    },
   { "disable-previews",  '\0',  0, G_OPTION_ARG_NONE,    &opt_no_previews,  "Don't generate previews",          NULL    },
+  { "parallel",          '\0',  0, G_OPTION_ARG_INT,     &opt_parallel,     "Transfer NUM files at once",       "NUM"   },
   { NULL }
 };
 
 static gboolean status_callback(mega_status_data* data, gpointer userdata)
 {
+  // per-byte progress is not useful when multiple transfers overlap
+  if (opt_parallel > 1)
+    return FALSE;
+
   if (!opt_noprogress && data->type == MEGA_STATUS_PROGRESS)
     tool_show_progress("copying...", data);
 
   return FALSE;
 }
 
+// local sync state index: remembers (size, mtime, remote handle) of every
+// successfully synced file so that unchanged files can be skipped on the
+// next run without touching the remote filesystem; stored next to the
+// session cache, keyed by the local/remote directory pair
+
+struct sync_index_entry
+{
+  guint64 size;
+  gint64 mtime;
+  gchar* handle;
+};
+
+static GHashTable* sync_index;
+static gchar* sync_index_path;
+static gboolean sync_index_dirty;
+static GMutex sync_index_lock;
+
+static void sync_index_entry_free(struct sync_index_entry* e)
+{
+  g_free(e->handle);
+  g_free(e);
+}
+
+static void sync_index_load(void)
+{
+  gc_free gchar* data = NULL;
+  gchar** lines;
+  gint i;
+
+  gc_checksum_free GChecksum* cs = g_checksum_new(G_CHECKSUM_SHA1);
+  g_checksum_update(cs, (guchar*)opt_local_path, -1);
+  g_checksum_update(cs, (guchar*)"|", -1);
+  g_checksum_update(cs, (guchar*)opt_remote_path, -1);
+  gc_free gchar* filename = g_strconcat(g_checksum_get_string(cs), ".megacopy.cache", NULL);
+  sync_index_path = g_build_filename(g_get_tmp_dir(), filename, NULL);
+
+  sync_index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)sync_index_entry_free);
+
+  if (!g_file_get_contents(sync_index_path, &data, NULL, NULL))
+    return;
+
+  // one record per line: <size> <mtime> <handle> <remote path>
+  lines = g_strsplit(data, "\n", 0);
+  for (i = 0; lines[i]; i++)
+  {
+    gchar* handle = NULL;
+    gchar* path = NULL;
+    guint64 size;
+    gint64 mtime;
+
+    handle = strchr(lines[i], ' ');
+    if (handle)
+      handle = strchr(handle + 1, ' ');
+    if (handle)
+      path = strchr(handle + 1, ' ');
+
+    if (!path || sscanf(lines[i], "%" G_GUINT64_FORMAT " %" G_GINT64_FORMAT, &size, &mtime) != 2)
+      continue;
+
+    struct sync_index_entry* e = g_new0(struct sync_index_entry, 1);
+    e->size = size;
+    e->mtime = mtime;
+    e->handle = g_strndup(handle + 1, path - handle - 1);
+
+    g_hash_table_insert(sync_index, g_strdup(path + 1), e);
+  }
+
+  g_strfreev(lines);
+}
+
+static void sync_index_write_entry(gchar* path, struct sync_index_entry* e, GString* out)
+{
+  g_string_append_printf(out, "%" G_GUINT64_FORMAT " %" G_GINT64_FORMAT " %s %s\n", e->size, e->mtime, e->handle, path);
+}
+
+static void sync_index_save(void)
+{
+  if (!sync_index || !sync_index_dirty)
+    return;
+
+  gc_string_free GString* out = g_string_sized_new(g_hash_table_size(sync_index) * 64);
+  g_hash_table_foreach(sync_index, (GHFunc)sync_index_write_entry, out);
+
+  g_file_set_contents(sync_index_path, out->str, out->len, NULL);
+}
+
+static void sync_index_update(const gchar* remote_path, guint64 size, gint64 mtime, const gchar* handle)
+{
+  if (!sync_index)
+    return;
+
+  struct sync_index_entry* e = g_new0(struct sync_index_entry, 1);
+  e->size = size;
+  e->mtime = mtime;
+  e->handle = g_strdup(handle ? handle : "-");
+
+  g_mutex_lock(&sync_index_lock);
+  g_hash_table_insert(sync_index, g_strdup(remote_path), e);
+  sync_index_dirty = TRUE;
+  g_mutex_unlock(&sync_index_lock);
+}
+
+// returns TRUE when the file was synced before and didn't change since
+static gboolean sync_index_matches(const gchar* remote_path, guint64 size, gint64 mtime)
+{
+  if (!sync_index)
+    return FALSE;
+
+  struct sync_index_entry* e = g_hash_table_lookup(sync_index, remote_path);
+
+  return e && e->size == size && e->mtime == mtime;
+}
+
+static gboolean local_file_info(GFile* file, guint64* size, gint64* mtime)
+{
+  gc_object_unref GFileInfo* info = g_file_query_info(file, G_FILE_ATTRIBUTE_STANDARD_SIZE "," G_FILE_ATTRIBUTE_TIME_MODIFIED, G_FILE_QUERY_INFO_NONE, NULL, NULL);
+
+  if (!info)
+    return FALSE;
+
+  *size = g_file_info_get_size(info);
+  *mtime = g_file_info_get_attribute_uint64(info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+
+  return TRUE;
+}
+
+// parallel transfer pool: directories are created during the serial scan,
+// file transfers are queued and run on worker threads afterwards
+
+struct transfer_job
+{
+  gchar* local_path;
+  gchar* remote_path;
+  guint64 local_size;
+  gint64 local_mtime;
+  gchar* handle;
+};
+
+static GPtrArray* jobs;
+static gint jobs_next;
+static gint jobs_failed;
+
+static void add_transfer_job(const gchar* local_path, const gchar* remote_path, guint64 local_size, gint64 local_mtime, const gchar* handle)
+{
+  struct transfer_job* job = g_new0(struct transfer_job, 1);
+
+  job->local_path = g_strdup(local_path);
+  job->remote_path = g_strdup(remote_path);
+  job->local_size = local_size;
+  job->local_mtime = local_mtime;
+  job->handle = g_strdup(handle);
+
+  g_ptr_array_add(jobs, job);
+}
+
+static void free_transfer_job(struct transfer_job* job)
+{
+  g_free(job->local_path);
+  g_free(job->remote_path);
+  g_free(job->handle);
+  g_free(job);
+}
+
+static gpointer transfer_worker(gpointer data)
+{
+  gc_error_free GError* local_err = NULL;
+  gint idx;
+
+  while ((idx = g_atomic_int_add(&jobs_next, 1)) < (gint)jobs->len)
+  {
+    struct transfer_job* job = g_ptr_array_index(jobs, idx);
+    gboolean ok;
+
+    if (opt_download)
+    {
+      ok = mega_session_get(s, job->local_path, job->remote_path, &local_err);
+
+      if (ok)
+      {
+        guint64 size = 0;
+        gint64 mtime = 0;
+        gc_object_unref GFile* file = g_file_new_for_path(job->local_path);
+
+        if (local_file_info(file, &size, &mtime))
+          sync_index_update(job->remote_path, size, mtime, job->handle);
+      }
+    }
+    else
+    {
+      mega_node* n = mega_session_put(s, job->remote_path, job->local_path, &local_err);
+      ok = n != NULL;
+
+      if (ok)
+        sync_index_update(job->remote_path, job->local_size, job->local_mtime, n->handle);
+    }
+
+    if (ok)
+    {
+      g_print("F %s\n", opt_download ? job->local_path : job->remote_path);
+    }
+    else
+    {
+      g_printerr("ERROR: %s failed for %s: %s\n", opt_download ? "Download" : "Upload", job->remote_path, local_err->message);
+      g_clear_error(&local_err);
+      g_atomic_int_inc(&jobs_failed);
+    }
+  }
+
+  return NULL;
+}
+
+static gboolean run_transfer_jobs(void)
+{
+  gint i, n_workers = MIN(opt_parallel, (gint)jobs->len);
+  GThread* threads[16];
+
+  for (i = 0; i < n_workers; i++)
+    threads[i] = g_thread_new("megacopy worker", transfer_worker, NULL);
+
+  for (i = 0; i < n_workers; i++)
+    g_thread_join(threads[i]);
+
+  return jobs_failed == 0;
+}
+
 // upload operation
 
+// collect remote paths of local subdirectories that don't exist remotely
+// yet, so the whole tree can be created with batched mkdir calls up front
+static void up_collect_dirs(GFile* file, const gchar* remote_path, GSList** dirs)
+{
+  GFileEnumerator* e = g_file_enumerate_children(file, "standard::*", G_FILE_QUERY_INFO_NONE, NULL, NULL);
+  GFileInfo* i;
+
+  if (!e)
+    return;
+
+  while ((i = g_file_enumerator_next_file(e, NULL, NULL)))
+  {
+    if (g_file_info_get_file_type(i) == G_FILE_TYPE_DIRECTORY)
+    {
+      const gchar* name = g_file_info_get_name(i);
+      gc_object_unref GFile* child = g_file_get_child(file, name);
+      gchar* child_remote_path = g_strconcat(remote_path, "/", name, NULL);
+
+      mega_node* node = mega_session_stat(s, child_remote_path);
+      if (!node)
+      {
+        g_print("D %s\n", child_remote_path);
+        *dirs = g_slist_prepend(*dirs, child_remote_path);
+      }
+
+      // paths colliding with remote files are left to up_sync_dir to report
+      if (!node || mega_node_is_container(node))
+        up_collect_dirs(child, child_remote_path, dirs);
+
+      if (node)
+        g_free(child_remote_path);
+    }
+
+    g_object_unref(i);
+  }
+
+  g_object_unref(e);
+}
+
+// create the whole remote directory tree with batched mkdir calls, instead
+// of one round-trip per directory during the recursive sync; on failure the
+// sync continues and up_sync_dir retries each missing directory on its own
+static void up_create_dirs(GFile* root, const gchar* remote_path)
+{
+  gc_error_free GError* local_err = NULL;
+  GSList* dirs = NULL;
+
+  up_collect_dirs(root, remote_path, &dirs);
+
+  if (dirs && !mega_session_mkdir_bulk(s, dirs, &local_err))
+    g_printerr("WARNING: Batched directory creation failed, falling back to one call per directory: %s\n", local_err->message);
+
+  g_slist_free_full(dirs, g_free);
+}
+
 static gboolean up_sync_file(GFile* root, GFile* file, const gchar* remote_path)
 {
   GError *local_err = NULL;
+  guint64 local_size = 0;
+  gint64 local_mtime = 0;
+  gboolean have_info = local_file_info(file, &local_size, &local_mtime);
+
+  // skip files that didn't change since the last successful sync without
+  // consulting the remote filesystem
+  if (have_info && sync_index_matches(remote_path, local_size, local_mtime))
+    return TRUE;
 
   mega_node* node = mega_session_stat(s, remote_path);
   if (node)
@@ -59,11 +353,20 @@ static gboolean up_sync_file(GFile* root, GFile* file, const gchar* remote_path)
     return FALSE;
   }
 
+  if (!opt_dryrun && jobs)
+  {
+    gc_free gchar* local_path = g_file_get_path(file);
+
+    add_transfer_job(local_path, remote_path, local_size, local_mtime, NULL);
+    return TRUE;
+  }
+
   g_print("F %s\n", remote_path);
 
   if (!opt_dryrun)
   {
-    if (!mega_session_put(s, remote_path, g_file_get_path(file), &local_err))
+    mega_node* n = mega_session_put(s, remote_path, g_file_get_path(file), &local_err);
+    if (!n)
     {
       if (!opt_noprogress)
         g_print("\r" ESC_CLREOL);
@@ -73,6 +376,9 @@ static gboolean up_sync_file(GFile* root, GFile* file, const gchar* remote_path)
       return FALSE;
     }
 
+    if (have_info)
+      sync_index_update(remote_path, local_size, local_mtime, n->handle);
+
     if (!opt_noprogress)
       g_print("\r" ESC_CLREOL);
   }
@@ -160,10 +466,23 @@ static gboolean dl_sync_file(mega_node* node, GFile* file, const gchar* remote_p
 
   if (g_file_query_exists(file, NULL))
   {
+    guint64 local_size = 0;
+    gint64 local_mtime = 0;
+
+    // files downloaded by a previous run are fine as they are
+    if (local_file_info(file, &local_size, &local_mtime) && sync_index_matches(remote_path, local_size, local_mtime))
+      return TRUE;
+
     g_printerr("ERROR: File already exists at %s\n", local_path);
     return FALSE;
   }
 
+  if (!opt_dryrun && jobs)
+  {
+    add_transfer_job(local_path, remote_path, 0, 0, node->handle);
+    return TRUE;
+  }
+
   g_print("F %s\n", local_path);
 
   if (!opt_dryrun)
@@ -178,6 +497,11 @@ static gboolean dl_sync_file(mega_node* node, GFile* file, const gchar* remote_p
       return FALSE;
     }
 
+    guint64 local_size = 0;
+    gint64 local_mtime = 0;
+    if (local_file_info(file, &local_size, &local_mtime))
+      sync_index_update(remote_path, local_size, local_mtime, node->handle);
+
     if (!opt_noprogress)
       g_print("\r" ESC_CLREOL);
   }
@@ -264,6 +588,13 @@ int main(int ac, char* av[])
 
   mega_session_watch_status(s, status_callback, NULL);
 
+  opt_parallel = CLAMP(opt_parallel, 1, 16);
+  if (opt_parallel > 1)
+    jobs = g_ptr_array_new_with_free_func((GDestroyNotify)free_transfer_job);
+
+  if (!opt_dryrun)
+    sync_index_load();
+
   // check remote dir existence
   mega_node* remote_dir = mega_session_stat(s, opt_remote_path);
   if (!remote_dir)
@@ -285,6 +616,9 @@ int main(int ac, char* av[])
   {
     if (!dl_sync_dir(remote_dir, local_file, opt_remote_path))
       status = 1;
+
+    if (jobs && !run_transfer_jobs())
+      status = 1;
   }
   else
   {
@@ -294,12 +628,23 @@ int main(int ac, char* av[])
       goto err1;
     }
 
+    if (!opt_dryrun)
+      up_create_dirs(local_file, opt_remote_path);
+
     if (!up_sync_dir(local_file, local_file, opt_remote_path))
       status = 1;
 
+    if (jobs && !run_transfer_jobs())
+      status = 1;
+
     mega_session_save(s, NULL);
   }
 
+  sync_index_save();
+
+  if (jobs)
+    g_ptr_array_free(jobs, TRUE);
+
   g_object_unref(local_file);
   tool_fini(s);
   return status;
@@ -0,0 +1,455 @@
+/*
+ *  megatools - Mega.nz client library and tools
+ *  Copyright (C) 2013  Ondřej Jirman <megous@megous.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Daemon holding a live session (decrypted keys, warm pathmap, pooled
+// connections), serving commands over a unix socket. Amortizes the
+// login/session-load/pathmap cost over many invocations: a command round
+// trip takes milliseconds instead of the seconds a full tool startup needs.
+//
+// Protocol: one command per line ("ls /Root", quoting per shell rules),
+// response is zero or more data lines followed by "OK" or "ERR: <message>".
+
+#include "tools.h"
+
+#ifndef G_OS_WIN32
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+
+static gchar* opt_socket = NULL;
+static gchar* opt_command = NULL;
+
+static GOptionEntry entries[] =
+{
+  { "socket",        's',   0, G_OPTION_ARG_FILENAME,  &opt_socket,   "Unix socket path (defaults to megatools.sock in the runtime dir)",  "PATH" },
+  { "command",       'c',   0, G_OPTION_ARG_STRING,    &opt_command,  "Send COMMAND to a running daemon and print the reply",               "COMMAND" },
+  { NULL }
+};
+
+static mega_session* s;
+static gboolean quit_requested;
+
+static gchar* get_socket_path(void)
+{
+  if (opt_socket)
+    return g_strdup(opt_socket);
+
+  return g_strdup_printf("%s/megatools.sock", g_get_user_runtime_dir());
+}
+
+// {{{ command handlers
+
+static gint compare_node(mega_node* a, mega_node* b)
+{
+  gchar path1[4096];
+  gchar path2[4096];
+
+  if (mega_node_get_path(a, path1, 4096) && mega_node_get_path(b, path2, 4096))
+    return strcmp(path1, path2);
+  return 0;
+}
+
+static void cmd_ls(FILE* out, gint ac, gchar** av)
+{
+  GSList *l, *i;
+
+  if (ac > 1)
+    l = mega_session_ls(s, av[1], FALSE);
+  else
+    l = mega_session_ls_all(s);
+
+  l = g_slist_sort(l, (GCompareFunc)compare_node);
+
+  for (i = l; i; i = i->next)
+  {
+    gc_free gchar* node_path = mega_node_get_path_dup(i->data);
+
+    fprintf(out, "%s\n", node_path);
+  }
+
+  g_slist_free(l);
+  fprintf(out, "OK\n");
+}
+
+static void cmd_stat(FILE* out, gint ac, gchar** av)
+{
+  if (ac < 2)
+  {
+    fprintf(out, "ERR: Usage: stat <remotepath>\n");
+    return;
+  }
+
+  mega_node* n = mega_session_stat(s, av[1]);
+  if (!n)
+  {
+    fprintf(out, "ERR: Remote file not found: %s\n", av[1]);
+    return;
+  }
+
+  fprintf(out, "%s %d %" G_GUINT64_FORMAT " %" G_GINT64_FORMAT " %s\n", n->handle, n->type, n->size, (gint64)n->timestamp, n->name);
+  fprintf(out, "OK\n");
+}
+
+static void cmd_df(FILE* out)
+{
+  gc_error_free GError* local_err = NULL;
+
+  mega_user_quota* q = mega_session_user_quota(s, &local_err);
+  if (!q)
+  {
+    fprintf(out, "ERR: Can't determine disk usage: %s\n", local_err->message);
+    return;
+  }
+
+  fprintf(out, "total %" G_GUINT64_FORMAT "\n", q->total);
+  fprintf(out, "used %" G_GUINT64_FORMAT "\n", q->used);
+  fprintf(out, "free %" G_GUINT64_FORMAT "\n", q->total - q->used);
+  g_free(q);
+  fprintf(out, "OK\n");
+}
+
+static void cmd_mkdir(FILE* out, gint ac, gchar** av)
+{
+  gc_error_free GError* local_err = NULL;
+
+  if (ac < 2)
+  {
+    fprintf(out, "ERR: Usage: mkdir <remotepath>\n");
+    return;
+  }
+
+  if (!mega_session_mkdir(s, av[1], &local_err))
+  {
+    fprintf(out, "ERR: Can't create directory %s: %s\n", av[1], local_err->message);
+    return;
+  }
+
+  mega_session_save(s, NULL);
+  fprintf(out, "OK\n");
+}
+
+static void cmd_rm(FILE* out, gint ac, gchar** av)
+{
+  gc_error_free GError* local_err = NULL;
+
+  if (ac < 2)
+  {
+    fprintf(out, "ERR: Usage: rm <remotepath>\n");
+    return;
+  }
+
+  if (!mega_session_rm(s, av[1], &local_err))
+  {
+    fprintf(out, "ERR: Can't remove %s: %s\n", av[1], local_err->message);
+    return;
+  }
+
+  mega_session_save(s, NULL);
+  fprintf(out, "OK\n");
+}
+
+static void cmd_put(FILE* out, gint ac, gchar** av)
+{
+  gc_error_free GError* local_err = NULL;
+
+  if (ac < 3)
+  {
+    fprintf(out, "ERR: Usage: put <localpath> <remotepath>\n");
+    return;
+  }
+
+  if (!mega_session_put(s, av[2], av[1], &local_err))
+  {
+    fprintf(out, "ERR: Upload failed for %s: %s\n", av[1], local_err->message);
+    return;
+  }
+
+  mega_session_save(s, NULL);
+  fprintf(out, "OK\n");
+}
+
+static void cmd_get(FILE* out, gint ac, gchar** av)
+{
+  gc_error_free GError* local_err = NULL;
+
+  if (ac < 3)
+  {
+    fprintf(out, "ERR: Usage: get <remotepath> <localpath>\n");
+    return;
+  }
+
+  if (!mega_session_get(s, av[2], av[1], &local_err))
+  {
+    fprintf(out, "ERR: Download failed for %s: %s\n", av[1], local_err->message);
+    return;
+  }
+
+  fprintf(out, "OK\n");
+}
+
+static void cmd_refresh(FILE* out)
+{
+  gc_error_free GError* local_err = NULL;
+
+  if (!mega_session_refresh(s, &local_err))
+  {
+    fprintf(out, "ERR: Can't refresh filesystem: %s\n", local_err->message);
+    return;
+  }
+
+  mega_session_save(s, NULL);
+  fprintf(out, "OK\n");
+}
+
+static void handle_command(FILE* out, const gchar* line)
+{
+  gc_error_free GError* local_err = NULL;
+  gchar** av = NULL;
+  gint ac = 0;
+
+  if (!g_shell_parse_argv(line, &ac, &av, &local_err))
+  {
+    fprintf(out, "ERR: Can't parse command: %s\n", local_err->message);
+    return;
+  }
+
+  if (!strcmp(av[0], "ls"))
+    cmd_ls(out, ac, av);
+  else if (!strcmp(av[0], "stat"))
+    cmd_stat(out, ac, av);
+  else if (!strcmp(av[0], "df"))
+    cmd_df(out);
+  else if (!strcmp(av[0], "mkdir"))
+    cmd_mkdir(out, ac, av);
+  else if (!strcmp(av[0], "rm"))
+    cmd_rm(out, ac, av);
+  else if (!strcmp(av[0], "put"))
+    cmd_put(out, ac, av);
+  else if (!strcmp(av[0], "get"))
+    cmd_get(out, ac, av);
+  else if (!strcmp(av[0], "refresh"))
+    cmd_refresh(out);
+  else if (!strcmp(av[0], "ping"))
+    fprintf(out, "OK\n");
+  else if (!strcmp(av[0], "quit"))
+  {
+    quit_requested = TRUE;
+    fprintf(out, "OK\n");
+  }
+  else
+    fprintf(out, "ERR: Unknown command: %s\n", av[0]);
+
+  g_strfreev(av);
+}
+
+// }}}
+// {{{ server
+
+static int run_server(void)
+{
+  gc_free gchar* path = get_socket_path();
+  struct sockaddr_un addr;
+  int fd;
+
+  if (strlen(path) >= sizeof(addr.sun_path))
+  {
+    g_printerr("ERROR: Socket path is too long: %s\n", path);
+    return 1;
+  }
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+  {
+    g_printerr("ERROR: Can't create socket: %s\n", g_strerror(errno));
+    return 1;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  // the socket carries an authenticated session, keep it private
+  unlink(path);
+  mode_t old_umask = umask(0077);
+
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0)
+  {
+    g_printerr("ERROR: Can't listen on %s: %s\n", path, g_strerror(errno));
+    umask(old_umask);
+    close(fd);
+    return 1;
+  }
+
+  umask(old_umask);
+  g_print("Listening on %s\n", path);
+
+  while (!quit_requested)
+  {
+    int cfd = accept(fd, NULL, NULL);
+    if (cfd < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      g_printerr("ERROR: accept failed: %s\n", g_strerror(errno));
+      break;
+    }
+
+    FILE* io = fdopen(cfd, "r+");
+    if (!io)
+    {
+      close(cfd);
+      continue;
+    }
+
+    gchar line[4096];
+    while (!quit_requested && fgets(line, sizeof(line), io))
+    {
+      g_strstrip(line);
+      if (line[0] == '\0')
+        continue;
+
+      handle_command(io, line);
+      fflush(io);
+    }
+
+    fclose(io);
+  }
+
+  close(fd);
+  unlink(path);
+  return 0;
+}
+
+// }}}
+// {{{ client
+
+static int run_client(void)
+{
+  gc_free gchar* path = get_socket_path();
+  struct sockaddr_un addr;
+  int fd;
+
+  if (strlen(path) >= sizeof(addr.sun_path))
+  {
+    g_printerr("ERROR: Socket path is too long: %s\n", path);
+    return 1;
+  }
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+  {
+    g_printerr("ERROR: Can't create socket: %s\n", g_strerror(errno));
+    return 1;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+  {
+    g_printerr("ERROR: Can't connect to daemon at %s: %s\n", path, g_strerror(errno));
+    close(fd);
+    return 1;
+  }
+
+  FILE* io = fdopen(fd, "r+");
+  if (!io)
+  {
+    close(fd);
+    return 1;
+  }
+
+  fprintf(io, "%s\n", opt_command);
+  fflush(io);
+
+  gchar line[4096];
+  int status = 1;
+  while (fgets(line, sizeof(line), io))
+  {
+    if (!strcmp(line, "OK\n"))
+    {
+      status = 0;
+      break;
+    }
+
+    if (g_str_has_prefix(line, "ERR: "))
+    {
+      g_printerr("ERROR: %s", line + 5);
+      break;
+    }
+
+    fputs(line, stdout);
+  }
+
+  fclose(io);
+  return status;
+}
+
+// }}}
+
+int main(int ac, char* av[])
+{
+  ToolInitFlags flags = TOOL_INIT_AUTH;
+  gint i;
+
+  // the thin client only talks to the daemon's socket, it must not exit or
+  // prompt for credentials; the auth mode has to be decided before option
+  // parsing, so scan for -c/--command up front
+  for (i = 1; i < ac; i++)
+    if (!strcmp(av[i], "-c") || !strcmp(av[i], "--command") || g_str_has_prefix(av[i], "--command="))
+      flags = 0;
+
+  tool_init(&ac, &av, "- serve megatools commands from a persistent session", entries, flags);
+
+  // thin client mode doesn't need a session of its own
+  if (opt_command)
+  {
+    int status = run_client();
+    tool_fini(NULL);
+    return status;
+  }
+
+  s = tool_start_session(TOOL_SESSION_OPEN);
+  if (!s)
+  {
+    tool_fini(NULL);
+    return 1;
+  }
+
+  int status = run_server();
+
+  mega_session_save(s, NULL);
+  tool_fini(s);
+  return status;
+}
+
+#else
+
+int main(int ac, char* av[])
+{
+  g_printerr("ERROR: megadaemon is not supported on Windows\n");
+  return 1;
+}
+
+#endif
@@ -27,12 +27,14 @@ static gchar* opt_path = ".";
 static gboolean opt_stream = FALSE;
 static gboolean opt_noprogress = FALSE;
 static gboolean opt_print_names = FALSE;
+static gint opt_parallel = 1;
 
 static GOptionEntry entries[] =
 {
   { "path",          '\0',   0, G_OPTION_ARG_FILENAME,  &opt_path,        "Local directory or file name, to save data to",  "PATH" },
   { "no-progress",   '\0',   0, G_OPTION_ARG_NONE,      &opt_noprogress,  "Disable progress bar",                           NULL  },
   { "print-names",   '\0',   0, G_OPTION_ARG_NONE,      &opt_print_names, "Print names of downloaded files",                NULL  },
+  { "parallel",      '\0',   0, G_OPTION_ARG_INT,       &opt_parallel,    "Download NUM file links at once",                "NUM" },
   { NULL }
 };
 
@@ -41,6 +43,11 @@ static mega_session* s;
 
 static gboolean status_callback(mega_status_data* data, gpointer userdata)
 {
+  // per-byte progress reporting is disabled when multiple links are in
+  // flight, workers print one line per finished link instead
+  if (opt_parallel > 1)
+    return FALSE;
+
   if (opt_stream && data->type == MEGA_STATUS_DATA)
   {
     fwrite(data->data.buf, data->data.size, 1, stdout);
@@ -58,6 +65,110 @@ static gboolean status_callback(mega_status_data* data, gpointer userdata)
   return FALSE;
 }
 
+// {{{ parallel link queue
+
+// Queue of plain file links downloaded by opt_parallel worker threads.
+// API calls and node tree access are serialized inside the session, and
+// each mega_session_dl call opens its own data connection, so workers can
+// share one session. Folder links change the opened session, those are
+// still processed serially by main.
+
+struct dl_job
+{
+  gchar* handle;
+  gchar* key;
+  gchar* link;
+};
+
+static GPtrArray* jobs;
+static gint jobs_next;
+static gint jobs_failed;
+
+static void free_dl_job(struct dl_job* job)
+{
+  g_free(job->handle);
+  g_free(job->key);
+  g_free(job->link);
+  g_free(job);
+}
+
+static void add_dl_job(const gchar* handle, const gchar* key, const gchar* link)
+{
+  struct dl_job* job = g_new0(struct dl_job, 1);
+
+  job->handle = g_strdup(handle);
+  job->key = g_strdup(key);
+  job->link = g_strdup(link);
+  g_ptr_array_add(jobs, job);
+}
+
+static gpointer dl_worker(gpointer data)
+{
+  gint idx;
+
+  while ((idx = g_atomic_int_add(&jobs_next, 1)) < (gint)jobs->len)
+  {
+    struct dl_job* job = g_ptr_array_index(jobs, idx);
+    gc_error_free GError* local_err = NULL;
+    gint attempts = 0;
+    gint64 sleep_amt = 2000000;
+    gboolean ok = FALSE;
+
+    while (attempts < 5)
+    {
+      if (attempts > 0)
+      {
+        g_usleep(sleep_amt);
+        sleep_amt <<= 1;
+      }
+
+      if (mega_session_dl(s, job->handle, job->key, opt_path, &local_err))
+      {
+        ok = TRUE;
+        break;
+      }
+
+      attempts++;
+
+      // only retry failed downloads, e.g. HTTP_ERROR
+      // treat the rest of errors as failure, do not retry
+      if (g_error_matches(local_err, MEGA_ERROR, MEGA_ERROR_OTHER))
+        break;
+
+      g_clear_error(&local_err);
+    }
+
+    if (ok)
+    {
+      if (!opt_noprogress)
+        g_print("Downloaded %s\n", job->link);
+    }
+    else
+    {
+      g_printerr("ERROR: Download failed for '%s': %s\n", job->link, local_err ? local_err->message : "unknown error");
+      g_atomic_int_inc(&jobs_failed);
+    }
+  }
+
+  return NULL;
+}
+
+static gboolean run_dl_jobs(void)
+{
+  GThread* threads[16];
+  gint i, n_workers = MIN(opt_parallel, (gint)jobs->len);
+
+  for (i = 0; i < n_workers; i++)
+    threads[i] = g_thread_new("megadl worker", dl_worker, NULL);
+
+  for (i = 0; i < n_workers; i++)
+    g_thread_join(threads[i]);
+
+  return jobs_failed == 0;
+}
+
+// }}}
+
 // download operation
 
 static gboolean dl_sync_file(mega_node* node, GFile* file, const gchar* remote_path)
@@ -217,6 +328,10 @@ int main(int ac, char* av[])
 
   mega_session_watch_status(s, status_callback, NULL);
 
+  opt_parallel = CLAMP(opt_parallel, 1, 16);
+  if (opt_parallel > 1 && !opt_stream)
+    jobs = g_ptr_array_new_with_free_func((GDestroyNotify)free_dl_job);
+
   // process links
   for (i = 1; i < ac; i++)
   {
@@ -232,6 +347,12 @@ int main(int ac, char* av[])
       handle = g_match_info_fetch(m1, 1);
       key = g_match_info_fetch(m1, 2);
 
+      if (jobs)
+      {
+        add_dl_job(handle, key, link);
+        continue;
+      }
+
       gint attempts = 0;
       gint64 sleep_amt = 2000000;
       while (attempts < 5)
@@ -335,6 +456,15 @@ int main(int ac, char* av[])
     }
   }
 
+  // download queued file links
+  if (jobs)
+  {
+    if (jobs->len > 0 && !run_dl_jobs())
+      status = 1;
+
+    g_ptr_array_free(jobs, TRUE);
+  }
+
   tool_fini(s);
   return status;
 }
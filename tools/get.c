@@ -22,11 +22,15 @@
 static gchar* opt_path = ".";
 static gboolean opt_stream = FALSE;
 static gboolean opt_noprogress = FALSE;
+static gint64 opt_offset = 0;
+static gint64 opt_length = -1;
 
 static GOptionEntry entries[] =
 {
   { "path",          '\0',   0, G_OPTION_ARG_FILENAME,  &opt_path,  "Local directory or file name, to save data to",  "PATH" },
   { "no-progress",   '\0',   0, G_OPTION_ARG_NONE,    &opt_noprogress,  "Disable progress bar",   NULL},
+  { "offset",        '\0',   0, G_OPTION_ARG_INT64,   &opt_offset,  "Skip first NUM bytes of the remote file (streaming only)",  "NUM" },
+  { "length",        '\0',   0, G_OPTION_ARG_INT64,   &opt_length,  "Download only NUM bytes starting at --offset (streaming only)",  "NUM" },
   { NULL }
 };
 
@@ -75,6 +79,24 @@ int main(int ac, char* av[])
     return 1;
   }
 
+  gboolean ranged = opt_offset != 0 || opt_length >= 0;
+  if (ranged)
+  {
+    if (opt_offset < 0 || opt_length == 0)
+    {
+      g_printerr("ERROR: Invalid --offset or --length value!\n");
+      tool_fini(NULL);
+      return 1;
+    }
+
+    if (!opt_stream)
+    {
+      g_printerr("ERROR: Ranged download requires streaming mode (--path -)!\n");
+      tool_fini(NULL);
+      return 1;
+    }
+  }
+
   s = tool_start_session(TOOL_SESSION_OPEN);
   if (!s)
   {
@@ -84,13 +106,27 @@ int main(int ac, char* av[])
 
   mega_session_watch_status(s, status_callback, NULL);
 
+  // a single path touches just one subtree, don't keep the rest around
+  if (ac == 2)
+  {
+    gc_free gchar* path = tool_convert_filename(av[1], FALSE);
+
+    mega_session_narrow(s, path);
+  }
+
   gint i, status = 0;
   for (i = 1; i < ac; i++)
   {
     gc_free gchar* path = tool_convert_filename(av[i], FALSE);
 
     // perform download
-    if (!mega_session_get(s, opt_stream ? NULL : opt_path, path, &local_err))
+    gboolean dl_ok;
+    if (ranged)
+      dl_ok = mega_session_get_range(s, path, opt_offset, opt_length < 0 ? (guint64)-1 : (guint64)opt_length, &local_err);
+    else
+      dl_ok = mega_session_get(s, opt_stream ? NULL : opt_path, path, &local_err);
+
+    if (!dl_ok)
     {
       if (!opt_noprogress)
         g_print("\r" ESC_CLREOL "\n");
@@ -49,6 +49,50 @@ static gint compare_node(mega_node* a, mega_node* b)
   return 0;
 }
 
+static void print_header(void)
+{
+  if (opt_long && opt_header && !opt_export)
+  {
+    g_print("===================================================================================\n");
+    g_print("%-11s %-11s %-1s %13s %-19s %s\n", "Handle", "Owner", "T", "Size", "Mod. Date", opt_names ? "Filename" : "Path");
+    g_print("===================================================================================\n");
+  }
+}
+
+static gboolean print_node(mega_node* n, gpointer userdata)
+{
+  gc_free gchar* node_path = mega_node_get_path_dup(n);
+
+  if (opt_export)
+    g_print("%73s ", n->link ? mega_node_get_link(n, TRUE) : "");
+
+  if (opt_long)
+  {
+    GDateTime* dt = g_date_time_new_from_unix_local(n->timestamp);
+    gc_free gchar* time_str = g_date_time_format(dt, "%Y-%m-%d %H:%M:%S");
+    g_date_time_unref(dt);
+
+    gc_free gchar* size_str = NULL;
+    if (opt_human)
+      size_str = n->size > 0 ? g_format_size_full(n->size, G_FORMAT_SIZE_IEC_UNITS) : g_strdup("-");
+    else
+      size_str = n->size > 0 ? g_strdup_printf("%" G_GUINT64_FORMAT, n->size) : g_strdup("-");
+
+    g_print("%-11s %-11s %d %13s %19s %s\n",
+      n->handle, 
+      n->user_handle ? n->user_handle : "",
+      n->type,
+      size_str,
+      n->timestamp > 0 ? time_str : "", 
+      opt_names ? n->name : node_path
+    );
+  }
+  else
+    g_print("%s\n", opt_names ? n->name : node_path);
+
+  return TRUE;
+}
+
 int main(int ac, char* av[])
 {
   mega_session* s;
@@ -62,17 +106,48 @@ int main(int ac, char* av[])
   if (!s)
     return 1;
 
+  if (ac == 1 || ac > 2 || opt_recursive)
+    opt_names = FALSE;
+
+  // a single path touches just one subtree, don't traverse the rest
+  if (ac == 2)
+  {
+    gc_free gchar* path = tool_convert_filename(av[1], FALSE);
+
+    mega_session_narrow(s, path);
+  }
+
+  // exporting needs the whole set of nodes up front to batch the link
+  // requests, everything else streams with O(directory) memory
+  if (!opt_export)
+  {
+    print_header();
+
+    if (ac == 1)
+      mega_session_ls_foreach(s, "/", TRUE, print_node, NULL);
+
+    for (j = 1; j < ac; j++)
+    {
+      gc_free gchar* path = tool_convert_filename(av[j], FALSE);
+
+      mega_node* n = mega_session_stat(s, path);
+      if (n && (n->type == MEGA_NODE_FILE || !opt_names))
+        print_node(n, NULL);
+
+      mega_session_ls_foreach(s, path, opt_recursive, print_node, NULL);
+    }
+
+    tool_fini(s);
+    return 0;
+  }
+
   // gather nodes
   if (ac == 1)
   {
     l = mega_session_ls_all(s);
-    opt_names = FALSE;
   }
   else
   {
-    if (ac > 2 || opt_recursive)
-      opt_names = FALSE;
-
     for (j = 1; j < ac; j++)
     {
       gc_free gchar* path = tool_convert_filename(av[j], FALSE);
@@ -87,8 +162,7 @@ int main(int ac, char* av[])
 
   l = g_slist_sort(l, (GCompareFunc)compare_node);
 
-  // export if requested
-  if (opt_export && !mega_session_addlinks(s, l, &local_err))
+  if (!mega_session_addlinks(s, l, &local_err))
   {
     g_printerr("ERROR: Can't read links info from mega.nz: %s\n", local_err->message);
     g_slist_free(l);
@@ -96,45 +170,8 @@ int main(int ac, char* av[])
     return 1;
   }
 
-  if (l && opt_long && opt_header && !opt_export)
-  {
-    g_print("===================================================================================\n");
-    g_print("%-11s %-11s %-1s %13s %-19s %s\n", "Handle", "Owner", "T", "Size", "Mod. Date", opt_names ? "Filename" : "Path");
-    g_print("===================================================================================\n");
-  }
-
   for (i = l; i; i = i->next)
-  {
-    mega_node* n = i->data;
-    gc_free gchar* node_path = mega_node_get_path_dup(n);
-
-    if (opt_export)
-      g_print("%73s ", n->link ? mega_node_get_link(n, TRUE) : "");
-
-    if (opt_long)
-    {
-      GDateTime* dt = g_date_time_new_from_unix_local(n->timestamp);
-      gc_free gchar* time_str = g_date_time_format(dt, "%Y-%m-%d %H:%M:%S");
-      g_date_time_unref(dt);
-
-      gc_free gchar* size_str = NULL;
-      if (opt_human)
-        size_str = n->size > 0 ? g_format_size_full(n->size, G_FORMAT_SIZE_IEC_UNITS) : g_strdup("-");
-      else
-        size_str = n->size > 0 ? g_strdup_printf("%" G_GUINT64_FORMAT, n->size) : g_strdup("-");
-
-      g_print("%-11s %-11s %d %13s %19s %s\n",
-        n->handle, 
-        n->user_handle ? n->user_handle : "",
-        n->type,
-        size_str,
-        n->timestamp > 0 ? time_str : "", 
-        opt_names ? n->name : node_path
-      );
-    }
-    else
-      g_print("%s\n", opt_names ? n->name : node_path);
-  }
+    print_node(i->data, NULL);
 
   g_slist_free(l);
   tool_fini(s);
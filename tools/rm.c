@@ -46,6 +46,10 @@ int main(int ac, char* av[])
   }
 
   gint i, status = 0;
+
+  // batch removal commands into a single API request
+  mega_session_batch_begin(s);
+
   for (i = 1; i < ac; i++)
   {
     gc_free gchar* path = tool_convert_filename(av[i], FALSE);
@@ -58,7 +62,16 @@ int main(int ac, char* av[])
     }
   }
 
-  mega_session_save(s, NULL);
+  if (!mega_session_batch_commit(s, &local_err))
+  {
+    // nodes were already removed from the in-memory tree, but the server
+    // still has them; don't persist that state into the session cache
+    g_printerr("ERROR: Can't remove files: %s\n", local_err->message);
+    g_clear_error(&local_err);
+    status = 1;
+  }
+  else
+    mega_session_save(s, NULL);
 
   tool_fini(s);
   return status;